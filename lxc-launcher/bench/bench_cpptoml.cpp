@@ -0,0 +1,570 @@
+/*
+ * Copyright (c) 2019,2020 Panasonic Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * bench_cpptoml: throughput/allocation benchmark of the bundled cpptoml
+ *
+ *   bench_cpptoml [-s scale] [-n iterations] [-o result.json] [-k dir]
+ *
+ * Synthetic corpora are generated with a fixed seed, so runs are comparable
+ * across builds. Each corpus is measured in its own child process, so the
+ * reported peak RSS belongs to that corpus only. Results are printed (or
+ * written with -o) as one JSON document.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include <atomic>
+#include <fstream>
+#include <functional>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "cpptoml/cpptoml.h"
+
+/*
+ *
+ * allocation counter (all operator new of the process)
+ *
+ */
+static std::atomic<uint64_t> g_allocs(0);
+
+void* operator new (size_t size)
+{
+  g_allocs.fetch_add(1, std::memory_order_relaxed);
+  void *p = malloc(size ? size : 1);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+// out of line, so the compiler never pairs an inlined free() with new
+__attribute__((noinline)) void operator delete (void *p) noexcept
+{
+  free(p);
+}
+
+__attribute__((noinline)) void operator delete (void *p, size_t) noexcept
+{
+  free(p);
+}
+
+/*
+ *
+ * synthetic corpora
+ *
+ */
+class Rand
+{
+public:
+  Rand(uint64_t seed) : m_state(seed) {};
+
+  uint32_t next (void)
+  {
+    // xorshift64*
+    m_state ^= m_state >> 12;
+    m_state ^= m_state << 25;
+    m_state ^= m_state >> 27;
+    return (uint32_t)((m_state * 0x2545F4914F6CDD1DULL) >> 32);
+  }
+
+  uint32_t range (uint32_t n) { return next() % n; }
+
+private:
+  uint64_t m_state;
+};
+
+static void gen_containers (std::string& out, Rand& r, int scale)
+{
+  char buf[256];
+  for (int i = 0; i < 2000 * scale; i++) {
+    snprintf(buf, sizeof(buf),
+             "[[container]]\nname = \"GUEST_%d\"\nreboot = %d\npriority = \"%s\"\n\n",
+             i, r.range(2), r.range(4) ? "ivi" : "safety");
+    out += buf;
+    for (int s = 0; s < 2; s++) {
+      snprintf(buf, sizeof(buf),
+               "  [[container.screen]]\n  display = \"HDMI-A-%d\"\n  layer = %d\n"
+               "  ivi_id = [%d, %d]\n\n", s + 1, i * 10 + s, i * 100, i * 100 + 99);
+      out += buf;
+    }
+    snprintf(buf, sizeof(buf),
+             "  [[container.mirror]]\n  source = \"HDMI-A-1\"\n  display = \"HDMI-A-2\"\n"
+             "  layer = %d\n  x = %d\n  y = %d\n  width = 480\n  height = 270\n"
+             "  opacity = 0.%d\n\n", i * 10 + 9, r.range(1920), r.range(1080), r.range(10));
+    out += buf;
+    snprintf(buf, sizeof(buf),
+             "  [[container.storage]]\n  src = \"/dev/sd%c%d\"\n  dst = \"/dev/sd%c%d\"\n\n",
+             'a' + r.range(4), r.range(8), 'a' + r.range(4), r.range(8));
+    out += buf;
+  }
+}
+
+static void gen_nested (std::string& out, Rand& r, int scale)
+{
+  char buf[128];
+  for (int i = 0; i < 300 * scale; i++) {
+    // [n42.l1.l2...l15] with a few keys at every level
+    std::string name = "n" + std::to_string(i);
+    for (int d = 1; d <= 16; d++) {
+      out += "[" + name + "]\n";
+      snprintf(buf, sizeof(buf), "key = %u\nflag = %s\nlabel = \"level %d\"\n\n",
+               r.next(), r.range(2) ? "true" : "false", d);
+      out += buf;
+      name += ".l" + std::to_string(d);
+    }
+
+    // inline tables/arrays nested 8 deep
+    out += "[" + std::string("i") + std::to_string(i) + "]\ndeep = ";
+    for (int d = 0; d < 8; d++) {
+      out += "{ v = " + std::to_string(d) + ", a = [ ";
+    }
+    out += "1";
+    for (int d = 0; d < 8; d++) {
+      out += " ] }";
+    }
+    out += "\n\n";
+  }
+}
+
+static void gen_strings (std::string& out, Rand& r, int scale)
+{
+  static const char *words[] = {
+    "lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing", "elit",
+  };
+  static const char *escapes[] = {
+    "\\n", "\\t", "\\\"", "\\\\", "\\u00e9", "\\U0001F600",
+  };
+
+  for (int i = 0; i < 3000 * scale; i++) {
+    std::string s;
+    size_t len = 200 + r.range(1800);
+    while (s.size() < len) {
+      s += words[r.range(8)];
+      s += (r.range(8) == 0) ? escapes[r.range(6)] : " ";
+    }
+
+    switch (r.range(4)) {
+    case 0:
+      out += "lit" + std::to_string(i) + " = '" + std::string(len, 'x') + "'\n";
+      break;
+    case 1:
+      out += "ml" + std::to_string(i) + " = \"\"\"\n" + s + "\\\n    " + s + "\n\"\"\"\n";
+      break;
+    default:
+      out += "s" + std::to_string(i) + " = \"" + s + "\"\n";
+      break;
+    }
+  }
+}
+
+static void gen_numbers (std::string& out, Rand& r, int scale)
+{
+  char buf[64];
+  for (int i = 0; i < 2000 * scale; i++) {
+    out += "ints" + std::to_string(i) + " = [";
+    for (int j = 0; j < 50; j++) {
+      snprintf(buf, sizeof(buf), j ? ", %d" : "%d", (int)r.next());
+      out += buf;
+    }
+    out += "]\nfloats" + std::to_string(i) + " = [";
+    for (int j = 0; j < 50; j++) {
+      snprintf(buf, sizeof(buf), j ? ", %.6f" : "%.6f", (double)r.next() / 977.0);
+      out += buf;
+    }
+    snprintf(buf, sizeof(buf), "]\nhex%d = 0x%X\nsep%d = 1_000_%03u\n", i, r.next(), i, r.range(1000));
+    out += buf;
+  }
+}
+
+static void gen_dates (std::string& out, Rand& r, int scale)
+{
+  char buf[256];
+  for (int i = 0; i < 10000 * scale; i++) {
+    unsigned y = 1970 + r.range(100), mo = 1 + r.range(12), d = 1 + r.range(28);
+    unsigned h = r.range(24), mi = r.range(60), s = r.range(60);
+    snprintf(buf, sizeof(buf),
+             "odt%d = %04u-%02u-%02uT%02u:%02u:%02u.%03uZ\n"
+             "off%d = %04u-%02u-%02uT%02u:%02u:%02u+09:00\n"
+             "ldt%d = %04u-%02u-%02uT%02u:%02u:%02u\n"
+             "ld%d = %04u-%02u-%02u\nlt%d = %02u:%02u:%02u.%06u\n",
+             i, y, mo, d, h, mi, s, r.range(1000),
+             i, y, mo, d, h, mi, s,
+             i, y, mo, d, h, mi, s,
+             i, y, mo, d,
+             i, h, mi, s, r.range(1000000));
+    out += buf;
+  }
+}
+
+// log-derived: events with offset timestamps and arrays of samples
+static void gen_timestamps (std::string& out, Rand& r, int scale)
+{
+  char buf[256];
+  for (int i = 0; i < 2000 * scale; i++) {
+    unsigned h = r.range(24), mi = r.range(60), s = r.range(60);
+    snprintf(buf, sizeof(buf),
+             "[[event]]\nat = 2020-01-%02uT%02u:%02u:%02u.%06u+09:00\n"
+             "logged = 2020-01-%02u %02u:%02u:%02uZ\nsamples = [",
+             1 + r.range(28), h, mi, s, r.range(1000000),
+             1 + r.range(28), h, mi, s);
+    out += buf;
+    for (int j = 0; j < 16; j++) {
+      snprintf(buf, sizeof(buf), j ? ", %02u:%02u:%02u.%03u" : "%02u:%02u:%02u.%03u",
+               r.range(24), r.range(60), r.range(60), r.range(1000));
+      out += buf;
+    }
+    out += "]\n\n";
+  }
+}
+
+struct Corpus
+{
+  const char *name;
+  void (*gen)(std::string& out, Rand& r, int scale);
+};
+
+static const Corpus corpora[] = {
+  { "containers", gen_containers },
+  { "nested", gen_nested },
+  { "strings", gen_strings },
+  { "numbers", gen_numbers },
+  { "dates", gen_dates },
+  { "timestamps", gen_timestamps },
+};
+
+/*
+ *
+ * measurement
+ *
+ */
+static double now_sec (void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long peak_rss_kb (void)
+{
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_maxrss;
+}
+
+struct Result
+{
+  double sec = 0;               // best of iterations
+  uint64_t allocs = 0;          // per iteration
+};
+
+static Result measure (int iterations, const std::function<void(void)>& fn,
+                       const std::function<void(void)>& prepare = nullptr)
+{
+  Result result;
+  result.sec = 1e30;
+  for (int i = 0; i < iterations; i++) {
+    if (prepare) {
+      prepare();                // not timed
+    }
+
+    uint64_t allocs = g_allocs.load();
+    double start = now_sec();
+    fn();
+    double sec = now_sec() - start;
+    if (sec < result.sec) {
+      result.sec = sec;
+    }
+    result.allocs = g_allocs.load() - allocs;
+  }
+  return result;
+}
+
+/*
+ * every value through the typed accessors, as a config consumer would
+ */
+static uint64_t walk (const cpptoml::table& table)
+{
+  uint64_t n = 0;
+  for (auto& entry : table) {
+    const std::string& key = entry.first;
+    if (entry.second->is_table()) {
+      n += walk(*table.get_table(key));
+    } else if (entry.second->is_table_array()) {
+      for (auto& t : *table.get_table_array(key)) {
+        n += walk(*t);
+      }
+    } else if (entry.second->is_array()) {
+      auto array = table.get_array(key);
+      n += array->get().size();
+    } else if (table.get_as<std::string>(key) || table.get_as<int64_t>(key) ||
+               table.get_as<double>(key) || table.get_as<bool>(key) ||
+               table.get_as<cpptoml::offset_datetime>(key) ||
+               table.get_as<cpptoml::local_datetime>(key) ||
+               table.get_as<cpptoml::local_date>(key) ||
+               table.get_as<cpptoml::local_time>(key)) {
+      n++;
+    }
+  }
+  return n;
+}
+
+/*
+ * qualified names of all keys not below an array of tables
+ */
+static void qualified_keys (const cpptoml::table& table, const std::string& prefix,
+                            std::vector<std::string>& keys)
+{
+  for (auto& entry : table) {
+    if (entry.first.find('.') != std::string::npos) {
+      continue;                 // not addressable by get_qualified
+    }
+    std::string key = prefix.empty() ? entry.first : prefix + "." + entry.first;
+    keys.push_back(key);
+    if (entry.second->is_table()) {
+      qualified_keys(*entry.second->as_table(), key, keys);
+    }
+  }
+}
+
+/*
+ * kb: bytes processed (MB/s), ops: operations done (ops/s), 0: not reported
+ * allocs_per_kb is always relative to the size of the document
+ */
+static void json_op (std::string& out, const char *name, const Result& r,
+                     double doc_kb, double kb, double ops)
+{
+  char buf[256];
+  snprintf(buf, sizeof(buf), "%s\"%s\": { \"sec\": %.6f, ",
+           out.empty() ? "" : ",\n      ", name, r.sec);
+  out += buf;
+  if (kb > 0) {
+    snprintf(buf, sizeof(buf), "\"mb_per_s\": %.2f, ", kb / 1024.0 / r.sec);
+    out += buf;
+  }
+  if (ops > 0) {
+    snprintf(buf, sizeof(buf), "\"ops_per_s\": %.0f, ", ops / r.sec);
+    out += buf;
+  }
+  snprintf(buf, sizeof(buf), "\"allocs\": %llu, \"allocs_per_kb\": %.2f }",
+           (unsigned long long)r.allocs, r.allocs / doc_kb);
+  out += buf;
+}
+
+static std::string run_corpus (const Corpus& corpus, int scale, int iterations,
+                               const std::string& dir)
+{
+  std::string text;
+  Rand r(0x5eed + (uint64_t)(&corpus - corpora));
+  corpus.gen(text, r, scale);
+
+  std::string path = dir + "/bench_cpptoml_" + corpus.name + ".toml";
+  FILE *fp = fopen(path.c_str(), "w");
+  if (!fp || fwrite(text.data(), 1, text.size(), fp) != text.size()) {
+    fprintf(stderr, "cannot write %s\n", path.c_str());
+    exit(EXIT_FAILURE);
+  }
+  fclose(fp);
+
+  double kb = text.size() / 1024.0;
+  std::string ops;
+  std::shared_ptr<cpptoml::table> root;
+
+  auto release = [&]() { root.reset(); };
+
+  cpptoml::parse_options options;
+  options.use_arena = true;
+  Result parse_arena = measure(iterations, [&]() { root = cpptoml::parse_file(path, options); },
+                               release);
+  json_op(ops, "parse_file_arena", parse_arena, kb, kb, 0);
+
+  Result parse = measure(iterations, [&]() { root = cpptoml::parse_file(path); }, release);
+  json_op(ops, "parse_file", parse, kb, kb, 0);
+
+  Result parse_stream = measure(iterations, [&]() {
+    std::ifstream file(path);
+    cpptoml::parser p(file);
+    root = p.parse();
+  }, release);
+  json_op(ops, "parse_stream", parse_stream, kb, kb, 0);
+
+  uint64_t values = 0;
+  Result accessors = measure(iterations, [&]() { values = walk(*root); });
+  json_op(ops, "accessors", accessors, kb, 0, values);
+
+  std::vector<std::string> keys;
+  qualified_keys(*root, "", keys);
+  uint64_t found = 0;
+  Result qualified = measure(iterations, [&]() {
+    for (auto& key : keys) {
+      found += root->get_qualified(key) != nullptr;
+    }
+  });
+  json_op(ops, "get_qualified", qualified, kb, 0, keys.size());
+
+  std::vector<cpptoml::path> paths(keys.begin(), keys.end());
+  Result qualified_path = measure(iterations, [&]() {
+    for (auto& key : paths) {
+      found += root->contains_qualified(key);
+    }
+  });
+  json_op(ops, "get_qualified_path", qualified_path, kb, 0, paths.size());
+
+  cpptoml::path_cache cache(root);
+  Result cached = measure(iterations, [&]() {
+    for (auto& key : paths) {
+      found += cache.get(key) != nullptr;
+    }
+  });
+  json_op(ops, "path_cache", cached, kb, 0, paths.size());
+
+  size_t written = 0;
+  Result writer = measure(iterations, [&]() {
+    std::ostringstream ss;
+    cpptoml::toml_writer w(ss);
+    root->accept(w);
+    written = ss.tellp();
+  });
+  json_op(ops, "toml_writer", writer, kb, written / 1024.0, 0);
+
+  cpptoml::output_buffer buffer;
+  Result buffer_writer = measure(iterations, [&]() {
+    buffer.clear();
+    cpptoml::toml_buffer_writer w(buffer);
+    root->accept(w);
+    written = buffer.size();
+  });
+  json_op(ops, "toml_buffer_writer", buffer_writer, kb, written / 1024.0, 0);
+
+  // footprint of the tree, and the node allocations of one parse
+  cpptoml::memory_usage usage = root->memory_usage();
+  cpptoml::allocation_counter counter;
+  cpptoml::parse_options counted;
+  counted.allocations = &counter;
+  root = cpptoml::parse_file(path, counted);
+
+  root.reset();
+  unlink(path.c_str());
+
+  char buf[512];
+  snprintf(buf, sizeof(buf),
+           "    { \"corpus\": \"%s\", \"bytes\": %zu, \"values\": %llu, "
+           "\"qualified_keys\": %zu, \"peak_rss_kb\": %ld,\n"
+           "      \"footprint\": { \"nodes\": %zu, \"key_bytes\": %zu, \"string_bytes\": %zu, "
+           "\"string_heap_bytes\": %zu, \"node_bytes\": %zu, \"container_bytes\": %zu, "
+           "\"control_block_bytes\": %zu, \"total\": %zu, "
+           "\"node_allocs\": %zu, \"node_alloc_bytes\": %zu },\n",
+           corpus.name, text.size(), (unsigned long long)values, keys.size(), peak_rss_kb(),
+           usage.nodes(), usage.key_bytes, usage.string_bytes, usage.string_heap_bytes,
+           usage.node_bytes, usage.container_bytes, usage.control_block_bytes, usage.total(),
+           counter.count, counter.bytes);
+  return buf + std::string("      ") + ops + " }";
+}
+
+static void usage (const char *prog)
+{
+  fprintf(stderr, "usage: %s [-s scale] [-n iterations] [-o result.json] [-k dir]\n", prog);
+  exit(EXIT_FAILURE);
+}
+
+int main (int argc, char *argv[])
+{
+  int scale = 1;
+  int iterations = 5;
+  const char *output = nullptr;
+  std::string dir = "/tmp";
+
+  int opt;
+  while ((opt = getopt(argc, argv, "s:n:o:k:")) != -1) {
+    switch (opt) {
+    case 's': scale = atoi(optarg); break;
+    case 'n': iterations = atoi(optarg); break;
+    case 'o': output = optarg; break;
+    case 'k': dir = optarg; break;
+    default: usage(argv[0]);
+    }
+  }
+  if (scale <= 0 || iterations <= 0) {
+    usage(argv[0]);
+  }
+
+  std::string json = "{\n  \"scale\": " + std::to_string(scale) +
+                     ",\n  \"iterations\": " + std::to_string(iterations) +
+                     ",\n  \"results\": [\n";
+
+  for (size_t i = 0; i < sizeof(corpora) / sizeof(corpora[0]); i++) {
+    // one child per corpus: independent peak RSS
+    int fds[2];
+    if (pipe(fds) < 0) {
+      perror("pipe");
+      return EXIT_FAILURE;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+      close(fds[0]);
+      std::string result = run_corpus(corpora[i], scale, iterations, dir);
+      ssize_t ret = write(fds[1], result.data(), result.size());
+      _exit(ret == (ssize_t)result.size() ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    close(fds[1]);
+
+    std::string result;
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(fds[0], buf, sizeof(buf))) > 0) {
+      result.append(buf, n);
+    }
+    close(fds[0]);
+
+    int status;
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != EXIT_SUCCESS) {
+      fprintf(stderr, "corpus [%s] failed\n", corpora[i].name);
+      return EXIT_FAILURE;
+    }
+
+    json += result + (i + 1 < sizeof(corpora) / sizeof(corpora[0]) ? ",\n" : "\n");
+  }
+  json += "  ]\n}\n";
+
+  FILE *fp = output ? fopen(output, "w") : stdout;
+  if (!fp) {
+    perror(output);
+    return EXIT_FAILURE;
+  }
+  fputs(json.c_str(), fp);
+  if (output) {
+    fclose(fp);
+  }
+
+  return 0;
+}
@@ -0,0 +1,233 @@
+/*
+ * Copyright (c) 2019,2020 Panasonic Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * fuzz_cpptoml: differential fuzz target of the bundled cpptoml
+ *
+ * For every input
+ *   - the SIMD scanners must return the same pointers as the scalar one,
+ *   - parse_buffer() and the arena must agree with the line based stream
+ *     parser, parser(std::istream), which is the reference (the same tree,
+ *     or the same error),
+ *   - the work of parse_buffer() (bytes examined by the scanners, nodes and
+ *     node bytes allocated) must stay within a budget linear in the input,
+ *   - a parsed document written by toml_writer and toml_buffer_writer must
+ *     parse back into an equal tree.
+ *
+ * Work is counted rather than timed, so the budget is the same on every
+ * machine and under any sanitizer, and tight enough for short inputs. A
+ * violation is printed and aborts, so libFuzzer and AFL keep the input like
+ * a crash; slow inputs are findings, not timeouts.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include "cpptoml/cpptoml.h"
+
+// scanner calls plus bytes they examined in one parse, per input byte (the
+// parser examines every byte about once, rescanning shows up at once)
+#ifndef FUZZ_SCAN_PER_BYTE
+#define FUZZ_SCAN_PER_BYTE 2
+#endif
+
+// node allocations of one parse, per input byte
+#ifndef FUZZ_NODES_PER_BYTE
+#define FUZZ_NODES_PER_BYTE 2
+#endif
+#ifndef FUZZ_NODE_BYTES_PER_BYTE
+#define FUZZ_NODE_BYTES_PER_BYTE 512
+#endif
+
+static void fail (const char* what, const std::string& detail = std::string())
+{
+  fprintf(stderr, "fuzz_cpptoml: %s%s%s\n", what, detail.empty() ? "" : ": ", detail.c_str());
+  abort();
+}
+
+/*
+ *
+ * scalar vs. SIMD scanners
+ *
+ */
+static void check_scanners (const char* data, size_t size)
+{
+  using namespace cpptoml::detail;
+
+  static const scanner scalar = make_scanner(simd_level::scalar);
+  static const scanner simd[] = {
+    make_scanner(simd_level::sse2),
+    make_scanner(simd_level::avx2),
+    make_scanner(simd_level::neon),
+  };
+
+  const char* end = data + size;
+
+  // every offset of short inputs, a sample of the longer ones, so that all
+  // alignments and tails are covered
+  size_t step = size < 256 ? 1 : size / 97;
+  for (size_t off = 0; off <= size; off += step) {
+    const char* it = data + off;
+    for (auto& s : simd) {
+      if (s.level == simd_level::scalar) {
+        continue;
+      }
+      if (s.skip_blank(it, end) != scalar.skip_blank(it, end)) {
+        fail("skip_blank differs from scalar", std::to_string(off));
+      }
+      for (char delim : {'"', '\''}) {
+        if (s.find_string_special(it, end, delim) != scalar.find_string_special(it, end, delim)) {
+          fail("find_string_special differs from scalar", std::to_string(off));
+        }
+      }
+    }
+  }
+}
+
+/*
+ *
+ * counting scanner: the active one, plus one step per call and per byte
+ *
+ */
+static uint64_t g_scan_steps;
+
+static const char* skip_blank_counted (const char* it, const char* end)
+{
+  const char* stop = cpptoml::detail::active_scanner().skip_blank(it, end);
+  g_scan_steps += 1 + (stop - it);
+  return stop;
+}
+
+static const char* find_string_special_counted (const char* it, const char* end, char delim)
+{
+  const char* stop = cpptoml::detail::active_scanner().find_string_special(it, end, delim);
+  g_scan_steps += 1 + (stop - it);
+  return stop;
+}
+
+static const cpptoml::detail::scanner counting_scanner = {
+  cpptoml::detail::active_scanner().level, skip_blank_counted, find_string_special_counted,
+};
+
+/*
+ *
+ * parse
+ *
+ */
+struct Result
+{
+  std::shared_ptr<cpptoml::table> m_root;
+  std::string m_error;
+};
+
+template <class Parse>
+static Result parse (Parse&& fn)
+{
+  Result r;
+  try {
+    r.m_root = fn();
+  } catch (const cpptoml::parse_exception& e) {
+    r.m_error = e.what();
+  }
+  return r;
+}
+
+static void check_same (const char* what, const Result& a, const Result& b)
+{
+  if (a.m_error != b.m_error) {
+    fail(what, "\"" + a.m_error + "\" vs. \"" + b.m_error + "\"");
+  }
+  if (a.m_root && !cpptoml::equal(*a.m_root, *b.m_root)) {
+    fail(what, "trees differ");
+  }
+}
+
+static void check_round_trip (const char* what, const std::string& text, const cpptoml::table& root)
+{
+  Result r = parse([&]() { return cpptoml::parse_buffer(text.data(), text.size()); });
+  if (!r.m_root) {
+    fail(what, "output does not parse: " + r.m_error + "\n" + text);
+  }
+  if (!cpptoml::equal(root, *r.m_root)) {
+    fail(what, "output parses into a different tree\n" + text);
+  }
+}
+
+extern "C" int LLVMFuzzerTestOneInput (const uint8_t* bytes, size_t size)
+{
+  const char* data = reinterpret_cast<const char*>(bytes);
+
+  check_scanners(data, size);
+
+  // reference: the line based stream parser
+  std::istringstream stream(std::string(data, size));
+  Result ref = parse([&]() { return cpptoml::parser(stream).parse(); });
+
+  // parse_buffer(), within budget
+  cpptoml::allocation_counter counter;
+  cpptoml::parse_options options;
+  options.allocations = &counter;
+  options.scanner = &counting_scanner;
+
+  g_scan_steps = 0;
+  check_same("parse_buffer differs from the stream parser",
+             ref, parse([&]() { return cpptoml::parse_buffer(data, size, options); }));
+
+  if (g_scan_steps > FUZZ_SCAN_PER_BYTE * (size + 1)) {
+    fail("parse over scan budget",
+         std::to_string(g_scan_steps) + " steps for " + std::to_string(size) + " bytes");
+  }
+  if (counter.count > FUZZ_NODES_PER_BYTE * (size + 1)) {
+    fail("parse over node budget",
+         std::to_string(counter.count) + " nodes for " + std::to_string(size) + " bytes");
+  }
+  if (counter.bytes > FUZZ_NODE_BYTES_PER_BYTE * (size + 1)) {
+    fail("parse over allocation budget",
+         std::to_string(counter.bytes) + " bytes for " + std::to_string(size) + " bytes");
+  }
+
+  cpptoml::parse_options arena;
+  arena.use_arena = true;
+  check_same("arena parse differs from the stream parser",
+             ref, parse([&]() { return cpptoml::parse_buffer(data, size, arena); }));
+
+  if (!ref.m_root) {
+    return 0;
+  }
+
+  // writer round trip
+  std::ostringstream ss;
+  cpptoml::toml_writer writer(ss);
+  ref.m_root->accept(writer);
+  check_round_trip("toml_writer round trip", ss.str(), *ref.m_root);
+
+  cpptoml::output_buffer buffer;
+  cpptoml::toml_buffer_writer buffer_writer(buffer);
+  ref.m_root->accept(buffer_writer);
+  check_round_trip("toml_buffer_writer round trip", buffer.str(), *ref.m_root);
+
+  return 0;
+}
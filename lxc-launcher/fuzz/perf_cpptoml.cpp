@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2019,2020 Panasonic Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * perf_cpptoml: performance regression check of the bundled cpptoml
+ *
+ *   perf_cpptoml [-x factor] [-n repeat] file...
+ *
+ * Every file starts with its budget,
+ *
+ *   # budget: <usec> us, <count> allocs
+ *
+ * the fastest of n parses (parse_buffer(), errors included) must stay
+ * within usec * factor and one parse must not call operator new more than
+ * count times. Use -x for slow machines or sanitizer builds; the
+ * allocation budget does not scale. Exits with failure if any file is over.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <fstream>
+#include <iterator>
+#include <new>
+#include <string>
+
+#include "cpptoml/cpptoml.h"
+
+/*
+ *
+ * allocation counter (all operator new of the process)
+ *
+ */
+static std::atomic<uint64_t> g_allocs(0);
+
+void* operator new (size_t size)
+{
+  g_allocs.fetch_add(1, std::memory_order_relaxed);
+  void *p = malloc(size ? size : 1);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+// out of line, so the compiler never pairs an inlined free() with new
+__attribute__((noinline)) void operator delete (void *p) noexcept
+{
+  free(p);
+}
+
+__attribute__((noinline)) void operator delete (void *p, size_t) noexcept
+{
+  free(p);
+}
+
+static uint64_t now_ns (void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static bool parse (const std::string& data)
+{
+  try {
+    cpptoml::parse_buffer(data.data(), data.size());
+    return true;
+  } catch (const cpptoml::parse_exception&) {
+    return false;
+  }
+}
+
+// 0: within budget, 1: over budget, 2: unusable file
+static int check (const char* path, double factor, int repeat)
+{
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    fprintf(stderr, "%s: cannot read\n", path);
+    return 2;
+  }
+  std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+  unsigned long budget_us, budget_allocs;
+  if (sscanf(data.c_str(), "# budget: %lu us, %lu allocs", &budget_us, &budget_allocs) != 2) {
+    fprintf(stderr, "%s: no \"# budget: <usec> us, <count> allocs\" line\n", path);
+    return 2;
+  }
+
+  uint64_t allocs = g_allocs.load();
+  bool ok = parse(data);
+  allocs = g_allocs.load() - allocs;
+
+  uint64_t best = UINT64_MAX;
+  for (int i = 0; i < repeat; i++) {
+    uint64_t start = now_ns();
+    parse(data);
+    uint64_t elapsed = now_ns() - start;
+    if (elapsed < best) {
+      best = elapsed;
+    }
+  }
+
+  const char* name = strrchr(path, '/');
+  name = name ? name + 1 : path;
+
+  double usec = best / 1000.0;
+  double limit = budget_us * factor;
+  bool over = usec > limit || allocs > budget_allocs;
+
+  printf("%-28s %7zu bytes %-5s %10.1f us (%8.0f) %9llu allocs (%8lu)%s\n",
+         name, data.size(), ok ? "ok" : "error", usec, limit,
+         (unsigned long long)allocs, budget_allocs, over ? "  OVER BUDGET" : "");
+  return over ? 1 : 0;
+}
+
+int main (int argc, char *argv[])
+{
+  double factor = 1.0;
+  int repeat = 20;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "x:n:")) != -1) {
+    switch (opt) {
+    case 'x':
+      factor = atof(optarg);
+      break;
+    case 'n':
+      repeat = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-x factor] [-n repeat] file...\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (optind >= argc || factor <= 0 || repeat < 1) {
+    fprintf(stderr, "usage: %s [-x factor] [-n repeat] file...\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  int failed = 0;
+  for (int i = optind; i < argc; i++) {
+    failed += check(argv[i], factor, repeat) != 0;
+  }
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2019,2020 Panasonic Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Driver of the fuzz targets for compilers without libFuzzer
+ *
+ *   fuzz_cpptoml [-prefixes=1] [file|dir]...
+ *
+ * Runs every file given, and every file of every directory given, through
+ * LLVMFuzzerTestOneInput(). Without arguments a single input is read from
+ * stdin, which is what afl-fuzz feeds. Options of libFuzzer ("-runs=0")
+ * are ignored, so the same command line works with both builds.
+ *
+ * With -prefixes=1 every prefix of every file is run as well, so that each
+ * construct of the seeds is also seen cut off at the end of the input.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+extern "C" int LLVMFuzzerTestOneInput (const uint8_t* data, size_t size);
+
+static bool prefixes = false;
+
+static void run (const std::string& data)
+{
+  // a copy of exactly the input size, so ASan catches reads past its end
+  std::vector<uint8_t> input(data.begin(), data.end());
+  LLVMFuzzerTestOneInput(input.data(), input.size());
+}
+
+static void run_prefixes (const std::string& data)
+{
+  for (size_t len = 0; len < data.size(); len++) {
+    run(data.substr(0, len));
+  }
+}
+
+static int run_file (const std::string& path)
+{
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    fprintf(stderr, "cannot read %s\n", path.c_str());
+    return 1;
+  }
+  std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  fprintf(stderr, "%s\n", path.c_str());
+  if (prefixes) {
+    run_prefixes(data);
+  }
+  run(data);
+  return 0;
+}
+
+static int run_path (const std::string& path)
+{
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    fprintf(stderr, "cannot stat %s\n", path.c_str());
+    return 1;
+  }
+  if (!S_ISDIR(st.st_mode)) {
+    return run_file(path);
+  }
+
+  DIR *dir = opendir(path.c_str());
+  if (!dir) {
+    fprintf(stderr, "cannot open %s\n", path.c_str());
+    return 1;
+  }
+  std::vector<std::string> names;
+  while (struct dirent *e = readdir(dir)) {
+    if (e->d_name[0] != '.') {
+      names.push_back(e->d_name);
+    }
+  }
+  closedir(dir);
+  std::sort(names.begin(), names.end());
+
+  int errors = 0;
+  for (auto& name : names) {
+    errors += run_path(path + "/" + name);
+  }
+  return errors;
+}
+
+int main (int argc, char *argv[])
+{
+  std::vector<std::string> paths;
+  for (int i = 1; i < argc; i++) {
+    if (argv[i][0] != '-') {
+      paths.push_back(argv[i]);
+    } else if (strcmp(argv[i], "-prefixes=1") == 0) {
+      prefixes = true;
+    }
+  }
+
+  if (paths.empty()) {
+    std::string data((std::istreambuf_iterator<char>(std::cin)), std::istreambuf_iterator<char>());
+    if (prefixes) {
+      run_prefixes(data);
+    }
+    run(data);
+    return EXIT_SUCCESS;
+  }
+
+  int errors = 0;
+  for (auto& path : paths) {
+    errors += run_path(path);
+  }
+  return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
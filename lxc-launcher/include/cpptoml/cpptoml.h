@@ -8,20 +8,54 @@
 #define CPPTOML_H
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <cerrno>
 #include <clocale>
+#include <cstddef>
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <fstream>
 #include <iomanip>
+#include <limits>
 #include <map>
 #include <memory>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<charconv>)
+#include <charconv>
+#endif
+#endif
+
+#if !defined(CPPTOML_NO_SIMD)
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))          \
+    && defined(__SSE2__)
+#include <immintrin.h>
+#define CPPTOML_HAS_SSE2
+#define CPPTOML_HAS_AVX2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define CPPTOML_HAS_NEON
+#endif
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define CPPTOML_HAS_MMAP
+#endif
+
 #if __cplusplus > 201103L
 #define CPPTOML_DEPRECATED(reason) [[deprecated(reason)]]
 #elif defined(__clang__)
@@ -40,16 +74,420 @@ namespace cpptoml
 {
 class writer; // forward declaration
 class base;   // forward declaration
+
+namespace detail
+{
+/**
+ * Bit mask of the bytes equal to b among the 16 bytes at ctrl. Byte i is
+ * represented by group_stride bits starting at bit i * group_stride.
+ */
+#if defined(CPPTOML_HAS_SSE2)
+constexpr unsigned group_stride = 1;
+
+inline uint64_t group_match(const uint8_t* ctrl, uint8_t b)
+{
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl));
+    return static_cast<unsigned>(_mm_movemask_epi8(
+        _mm_cmpeq_epi8(v, _mm_set1_epi8(static_cast<char>(b)))));
+}
+#elif defined(CPPTOML_HAS_NEON)
+constexpr unsigned group_stride = 4;
+
+inline uint64_t group_match(const uint8_t* ctrl, uint8_t b)
+{
+    uint8x16_t eq = vceqq_u8(vld1q_u8(ctrl), vdupq_n_u8(b));
+    uint8x8_t n = vshrn_n_u16(vreinterpretq_u16_u8(eq), 4);
+    return vget_lane_u64(vreinterpret_u64_u8(n), 0);
+}
+#else
+constexpr unsigned group_stride = 1;
+
+inline uint64_t group_match(const uint8_t* ctrl, uint8_t b)
+{
+    uint64_t mask = 0;
+    for (unsigned i = 0; i < 16; ++i)
+        mask |= static_cast<uint64_t>(ctrl[i] == b) << i;
+    return mask;
+}
+#endif
+
+inline unsigned group_first(uint64_t mask)
+{
+    return static_cast<unsigned>(__builtin_ctzll(mask)) / group_stride;
+}
+
+inline uint64_t group_next(uint64_t mask)
+{
+    return mask
+           & ~(((uint64_t{1} << group_stride) - 1)
+               << (group_first(mask) * group_stride));
+}
+
+/**
+ * Insertion-ordered hash map from key to node, holding the entries of a
+ * table.
+ *
+ * Entries are stored in one contiguous vector, in insertion order, which
+ * is also the iteration order. Small tables are searched linearly by
+ * (cached) hash; larger ones get an open addressing index with one
+ * control byte per slot (empty, or 7 bits of the hash) probed 16 slots at
+ * a time, and the position of the entry in the vector.
+ *
+ * The interface is the subset of std::unordered_map used by table.
+ */
+class ordered_map
+{
+  public:
+    using key_type = std::string;
+    using mapped_type = std::shared_ptr<base>;
+    using value_type = std::pair<std::string, std::shared_ptr<base>>;
+    using size_type = std::size_t;
+    using iterator = std::vector<value_type>::iterator;
+    using const_iterator = std::vector<value_type>::const_iterator;
+
+    iterator begin()
+    {
+        return entries_.begin();
+    }
+
+    const_iterator begin() const
+    {
+        return entries_.begin();
+    }
+
+    iterator end()
+    {
+        return entries_.end();
+    }
+
+    const_iterator end() const
+    {
+        return entries_.end();
+    }
+
+    bool empty() const
+    {
+        return entries_.empty();
+    }
+
+    size_type size() const
+    {
+        return entries_.size();
+    }
+
+    /**
+     * Bytes of storage held for the entries and the index, including
+     * unused capacity (but not the heap blocks of long keys).
+     */
+    std::size_t memory() const
+    {
+        return entries_.capacity() * sizeof(value_type)
+               + hashes_.capacity() * sizeof(std::size_t) + ctrl_.capacity()
+               + slots_.capacity() * sizeof(uint32_t);
+    }
+
+    iterator find(const std::string& key)
+    {
+        auto i = lookup(key, hash(key));
+        return i == npos ? end() : begin() + static_cast<std::ptrdiff_t>(i);
+    }
+
+    const_iterator find(const std::string& key) const
+    {
+        auto i = lookup(key, hash(key));
+        return i == npos ? end() : begin() + static_cast<std::ptrdiff_t>(i);
+    }
+
+    /**
+     * Lookup with a hash precomputed by ordered_map::hash().
+     */
+    const_iterator find(const std::string& key, std::size_t h) const
+    {
+        auto i = lookup(key, h);
+        return i == npos ? end() : begin() + static_cast<std::ptrdiff_t>(i);
+    }
+
+    size_type count(const std::string& key) const
+    {
+        return lookup(key, hash(key)) != npos;
+    }
+
+    mapped_type& at(const std::string& key)
+    {
+        auto i = lookup(key, hash(key));
+        if (i == npos)
+            throw std::out_of_range{"ordered_map::at"};
+        return entries_[i].second;
+    }
+
+    const mapped_type& at(const std::string& key) const
+    {
+        auto i = lookup(key, hash(key));
+        if (i == npos)
+            throw std::out_of_range{"ordered_map::at"};
+        return entries_[i].second;
+    }
+
+    /**
+     * A new key is appended; an existing key keeps its position.
+     */
+    mapped_type& operator[](const std::string& key)
+    {
+        auto h = hash(key);
+        auto i = lookup(key, h);
+        if (i != npos)
+            return entries_[i].second;
+
+        entries_.emplace_back(key, nullptr);
+        hashes_.push_back(h);
+        if (!ctrl_.empty() && entries_.size() <= ctrl_.size() / 8 * 7)
+            index(entries_.size() - 1);
+        else if (entries_.size() > linear_max)
+            rehash(std::max<size_type>(group_size * 2, ctrl_.size() * 2));
+        return entries_.back().second;
+    }
+
+    /**
+     * Erasing keeps the order of the remaining entries (O(size)).
+     */
+    size_type erase(const std::string& key)
+    {
+        auto i = lookup(key, hash(key));
+        if (i == npos)
+            return 0;
+
+        entries_.erase(entries_.begin() + static_cast<std::ptrdiff_t>(i));
+        hashes_.erase(hashes_.begin() + static_cast<std::ptrdiff_t>(i));
+        if (entries_.size() > linear_max)
+            rehash(ctrl_.size());
+        else
+            rehash(0);
+        return 1;
+    }
+
+    void clear()
+    {
+        entries_.clear();
+        hashes_.clear();
+        rehash(0);
+    }
+
+    static std::size_t hash(const std::string& key)
+    {
+        return std::hash<std::string>{}(key);
+    }
+
+  private:
+    static constexpr size_type npos = static_cast<size_type>(-1);
+    static constexpr size_type linear_max = 8;
+    static constexpr size_type group_size = 16;
+    static constexpr uint8_t empty_slot = 0x80;
+
+    size_type lookup(const std::string& key, std::size_t h) const
+    {
+        if (ctrl_.empty())
+        {
+            for (size_type i = 0; i < entries_.size(); ++i)
+                if (hashes_[i] == h && entries_[i].first == key)
+                    return i;
+            return npos;
+        }
+
+        auto tag = static_cast<uint8_t>(h & 0x7f);
+        size_type mask = ctrl_.size() / group_size - 1;
+        size_type g = (h >> 7) & mask;
+        for (size_type step = 1;; ++step)
+        {
+            const uint8_t* ctrl = &ctrl_[g * group_size];
+            for (auto m = group_match(ctrl, tag); m; m = group_next(m))
+            {
+                size_type i = slots_[g * group_size + group_first(m)];
+                if (hashes_[i] == h && entries_[i].first == key)
+                    return i;
+            }
+            if (group_match(ctrl, empty_slot))
+                return npos;
+
+            // triangular probing visits every group
+            g = (g + step) & mask;
+        }
+    }
+
+    void index(size_type i)
+    {
+        auto h = hashes_[i];
+        size_type mask = ctrl_.size() / group_size - 1;
+        size_type g = (h >> 7) & mask;
+        for (size_type step = 1;; ++step)
+        {
+            const uint8_t* ctrl = &ctrl_[g * group_size];
+            if (auto m = group_match(ctrl, empty_slot))
+            {
+                size_type slot = g * group_size + group_first(m);
+                ctrl_[slot] = static_cast<uint8_t>(h & 0x7f);
+                slots_[slot] = static_cast<uint32_t>(i);
+                return;
+            }
+            g = (g + step) & mask;
+        }
+    }
+
+    /**
+     * Rebuilds the index with the given number of slots (a power of two,
+     * at least group_size), or drops it for 0.
+     */
+    void rehash(size_type capacity)
+    {
+        ctrl_.assign(capacity, uint8_t{empty_slot});
+        slots_.assign(capacity, 0);
+        if (capacity == 0)
+            return;
+        for (size_type i = 0; i < entries_.size(); ++i)
+            index(i);
+    }
+
+    std::vector<value_type> entries_;
+    std::vector<std::size_t> hashes_;
+    std::vector<uint8_t> ctrl_;
+    std::vector<uint32_t> slots_;
+};
+} // namespace detail
+
 #if defined(CPPTOML_USE_MAP)
 // a std::map will ensure that entries a sorted, albeit at a slight
-// performance penalty relative to the (default) unordered_map
+// performance penalty relative to the (default) ordered_map
 using string_to_base_map = std::map<std::string, std::shared_ptr<base>>;
 #else
-// by default an unordered_map is used for best performance as the
-// toml specification does not require entries to be sorted
-using string_to_base_map
-    = std::unordered_map<std::string, std::shared_ptr<base>>;
+// by default entries are kept in insertion order in a flat hash map
+using string_to_base_map = detail::ordered_map;
+#endif
+
+namespace detail
+{
+#if defined(CPPTOML_USE_MAP)
+inline std::size_t key_hash(const std::string&)
+{
+    return 0;
+}
+
+inline string_to_base_map::const_iterator
+find_key(const string_to_base_map& map, const std::string& key, std::size_t)
+{
+    return map.find(key);
+}
+#else
+inline std::size_t key_hash(const std::string& key)
+{
+    return string_to_base_map::hash(key);
+}
+
+inline string_to_base_map::const_iterator
+find_key(const string_to_base_map& map, const std::string& key, std::size_t h)
+{
+    return map.find(key, h);
+}
 #endif
+} // namespace detail
+
+/**
+ * A qualified key ("grandparent.parent.child") split and hashed once, for
+ * repeated lookups with table::get_qualified() and friends. Resolving a
+ * path does not allocate.
+ *
+ * Unlike a dotted string, a path built from its parts may contain keys
+ * with dots in them.
+ */
+class path
+{
+  public:
+    struct segment
+    {
+        std::string key;
+        std::size_t hash;
+    };
+
+    path(const std::string& key)
+    {
+        std::string::size_type p = 0;
+        std::string::size_type q;
+        while ((q = key.find('.', p)) != std::string::npos)
+        {
+            add(key.substr(p, q - p));
+            p = q + 1;
+        }
+        add(key.substr(p));
+    }
+
+    path(const char* key) : path(std::string{key})
+    {
+        // nothing
+    }
+
+    path(const std::vector<std::string>& parts)
+    {
+        for (const auto& part : parts)
+            add(part);
+    }
+
+    std::vector<segment>::const_iterator begin() const
+    {
+        return segments_.begin();
+    }
+
+    std::vector<segment>::const_iterator end() const
+    {
+        return segments_.end();
+    }
+
+    const segment& back() const
+    {
+        return segments_.back();
+    }
+
+    std::size_t size() const
+    {
+        return segments_.size();
+    }
+
+    /**
+     * Unique per path object, the key of path_cache entries.
+     */
+    uint64_t id() const
+    {
+        return id_;
+    }
+
+    /**
+     * The qualified key, for error messages.
+     */
+    std::string str() const
+    {
+        std::string result;
+        for (const auto& s : segments_)
+        {
+            if (!result.empty())
+                result += '.';
+            result += s.key;
+        }
+        return result;
+    }
+
+  private:
+    void add(std::string key)
+    {
+        auto h = detail::key_hash(key);
+        segments_.push_back({std::move(key), h});
+    }
+
+    static uint64_t next_id()
+    {
+        static std::atomic<uint64_t> id{0};
+        return ++id;
+    }
+
+    std::vector<segment> segments_;
+    uint64_t id_ = next_id();
+};
 
 // if defined, `base` will retain type information in form of an enum class
 // such that static_cast can be used instead of dynamic_cast
@@ -59,7 +497,10 @@ template <class T>
 class option
 {
   public:
-    option() : empty_{true}
+    // the value is initialized even when empty, so that copying an empty
+    // option (e.g. as the result of date_type()) never reads indeterminate
+    // storage
+    option() : empty_{true}, value_()
     {
         // nothing
     }
@@ -122,6 +563,33 @@ struct local_datetime : local_date, local_time
 {
 };
 
+struct offset_datetime;
+
+inline bool operator==(const local_date& a, const local_date& b)
+{
+    return a.year == b.year && a.month == b.month && a.day == b.day;
+}
+
+inline bool operator==(const local_time& a, const local_time& b)
+{
+    return a.hour == b.hour && a.minute == b.minute && a.second == b.second
+           && a.microsecond == b.microsecond;
+}
+
+inline bool operator==(const zone_offset& a, const zone_offset& b)
+{
+    return a.hour_offset == b.hour_offset && a.minute_offset == b.minute_offset;
+}
+
+inline bool operator==(const local_datetime& a, const local_datetime& b)
+{
+    return static_cast<const local_date&>(a) == static_cast<const local_date&>(b)
+           && static_cast<const local_time&>(a)
+                  == static_cast<const local_time&>(b);
+}
+
+inline bool operator==(const offset_datetime& a, const offset_datetime& b);
+
 struct offset_datetime : local_datetime, zone_offset
 {
     static inline struct offset_datetime from_zoned(const struct tm& t)
@@ -162,6 +630,14 @@ struct offset_datetime : local_datetime, zone_offset
     }
 };
 
+inline bool operator==(const offset_datetime& a, const offset_datetime& b)
+{
+    return static_cast<const local_datetime&>(a)
+               == static_cast<const local_datetime&>(b)
+           && static_cast<const zone_offset&>(a)
+                  == static_cast<const zone_offset&>(b);
+}
+
 CPPTOML_DEPRECATED("datetime has been renamed to offset_datetime")
 typedef offset_datetime datetime;
 
@@ -307,7 +783,7 @@ struct value_traits<T, typename std::enable_if<
 
     static value_type construct(T&& val)
     {
-        return value_type(val);
+        return value_type(std::forward<T>(val));
     }
 };
 
@@ -403,30 +879,427 @@ inline std::shared_ptr<T> make_element();
 inline std::shared_ptr<table> make_table();
 inline std::shared_ptr<table_array> make_table_array(bool is_inline = false);
 
-#if defined(CPPTOML_NO_RTTI)
-/// Base type used to store underlying data type explicitly if RTTI is disabled
-enum class base_type
+/**
+ * Counts the nodes allocated by the node factories (make_value(),
+ * make_array(), make_table(), make_table_array()) on a thread while it is
+ * installed with an allocation_scope; parsing installs the counter given
+ * in parse_options::allocations. Each node is a single allocation holding
+ * the node and its shared_ptr control block. Strings and element storage
+ * growing inside the nodes are not seen here, see base::memory_usage().
+ *
+ * Override allocated() to hook into the allocations.
+ */
+class allocation_counter
 {
-    NONE,
-    STRING,
-    LOCAL_TIME,
-    LOCAL_DATE,
-    LOCAL_DATETIME,
-    OFFSET_DATETIME,
-    INT,
-    FLOAT,
-    BOOL,
-    TABLE,
-    ARRAY,
-    TABLE_ARRAY
-};
+  public:
+    virtual ~allocation_counter() = default;
 
-/// Type traits class to convert C++ types to enum member
-template <class T>
-struct base_type_traits;
+    virtual void allocated(std::size_t size)
+    {
+        ++count;
+        bytes += size;
+    }
 
-template <>
-struct base_type_traits<std::string>
+    /// number of allocations
+    std::size_t count = 0;
+
+    /// bytes requested by them
+    std::size_t bytes = 0;
+};
+
+namespace detail
+{
+inline allocation_counter*& current_counter()
+{
+    static thread_local allocation_counter* current = nullptr;
+    return current;
+}
+
+inline void count_allocation(std::size_t size)
+{
+    if (auto c = current_counter())
+        c->allocated(size);
+}
+
+/**
+ * std::allocator, counted; used for nodes while a counter is installed.
+ */
+template <class T>
+class counting_allocator
+{
+  public:
+    using value_type = T;
+
+    counting_allocator()
+    {
+        // nothing
+    }
+
+    template <class U>
+    counting_allocator(const counting_allocator<U>&)
+    {
+        // nothing
+    }
+
+    T* allocate(std::size_t n)
+    {
+        count_allocation(n * sizeof(T));
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, std::size_t)
+    {
+        ::operator delete(p);
+    }
+
+    template <class U>
+    bool operator==(const counting_allocator<U>&) const
+    {
+        return true;
+    }
+
+    template <class U>
+    bool operator!=(const counting_allocator<U>&) const
+    {
+        return false;
+    }
+};
+} // namespace detail
+
+/**
+ * Installs an allocation_counter on the current thread for the lifetime
+ * of the scope. Scopes nest; the previous counter is restored on exit.
+ */
+class allocation_scope
+{
+  public:
+    allocation_scope(allocation_counter* counter)
+        : prev_{detail::current_counter()}
+    {
+        detail::current_counter() = counter;
+    }
+
+    allocation_scope(const allocation_scope&) = delete;
+    allocation_scope& operator=(const allocation_scope&) = delete;
+
+    ~allocation_scope()
+    {
+        detail::current_counter() = prev_;
+    }
+
+  private:
+    allocation_counter* prev_;
+};
+
+/**
+ * A bump allocator owning the nodes of one parsed document.
+ *
+ * Memory is carved out of large chunks and never returned piecemeal; all
+ * chunks are released together when the arena is destroyed, which happens
+ * when the last node allocated from it goes away. Nodes allocated from an
+ * arena are ordinary std::shared_ptr objects (created with
+ * std::allocate_shared), so they behave exactly like heap-allocated ones.
+ *
+ * An arena is not thread safe: it is only allocated from by the thread that
+ * installed it with an arena_scope.
+ */
+class arena
+{
+  public:
+    explicit arena(std::size_t chunk_size = 64 * 1024)
+        : chunk_size_{chunk_size}
+    {
+        // nothing
+    }
+
+    arena(const arena&) = delete;
+    arena& operator=(const arena&) = delete;
+
+    ~arena()
+    {
+        while (head_)
+        {
+            chunk* next = head_->next;
+            ::operator delete(head_);
+            head_ = next;
+        }
+    }
+
+    void* allocate(std::size_t size, std::size_t align)
+    {
+        std::size_t offset = (used_ + align - 1) & ~(align - 1);
+        if (!head_ || offset + size > head_->size)
+        {
+            // oversized requests get a chunk of their own behind the
+            // current one, so the rest of the current chunk stays usable
+            if (head_ && size > chunk_size_ / 4)
+                return data(add_chunk(size, head_->next, &head_->next));
+
+            head_ = add_chunk((std::max)(size, chunk_size_), head_, &head_);
+            offset = 0;
+        }
+        used_ = offset + size;
+        bytes_used_ += size;
+        return data(head_) + offset;
+    }
+
+    /**
+     * Bytes handed out to nodes.
+     */
+    std::size_t size() const
+    {
+        return bytes_used_;
+    }
+
+    /**
+     * Bytes reserved from the system for chunks.
+     */
+    std::size_t capacity() const
+    {
+        return bytes_reserved_;
+    }
+
+  private:
+    struct chunk
+    {
+        chunk* next;
+        std::size_t size;
+    };
+
+    static char* data(chunk* c)
+    {
+        return reinterpret_cast<char*>(c) + header_size();
+    }
+
+    static constexpr std::size_t header_size()
+    {
+        return (sizeof(chunk) + alignof(std::max_align_t) - 1)
+               & ~(alignof(std::max_align_t) - 1);
+    }
+
+    chunk* add_chunk(std::size_t size, chunk* next, chunk** link)
+    {
+        auto c = static_cast<chunk*>(::operator new(header_size() + size));
+        c->next = next;
+        c->size = size;
+        *link = c;
+        bytes_reserved_ += header_size() + size;
+        if (link != &head_)
+            bytes_used_ += size;
+        return c;
+    }
+
+    std::size_t chunk_size_;
+    chunk* head_ = nullptr;
+    std::size_t used_ = 0;
+    std::size_t bytes_used_ = 0;
+    std::size_t bytes_reserved_ = 0;
+};
+
+/**
+ * Standard allocator drawing from an arena. Every copy (including the one
+ * kept in each shared_ptr control block) shares ownership of the arena.
+ */
+template <class T>
+class arena_allocator
+{
+  public:
+    using value_type = T;
+
+    arena_allocator(std::shared_ptr<arena> a) : arena_{std::move(a)}
+    {
+        // nothing
+    }
+
+    template <class U>
+    arena_allocator(const arena_allocator<U>& other) : arena_{other.arena_}
+    {
+        // nothing
+    }
+
+    T* allocate(std::size_t n)
+    {
+        detail::count_allocation(n * sizeof(T));
+        return static_cast<T*>(arena_->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T*, std::size_t)
+    {
+        // released with the arena
+    }
+
+    template <class U>
+    bool operator==(const arena_allocator<U>& other) const
+    {
+        return arena_ == other.arena_;
+    }
+
+    template <class U>
+    bool operator!=(const arena_allocator<U>& other) const
+    {
+        return arena_ != other.arena_;
+    }
+
+  private:
+    template <class U>
+    friend class arena_allocator;
+
+    std::shared_ptr<arena> arena_;
+};
+
+namespace detail
+{
+inline std::shared_ptr<arena>*& current_arena()
+{
+    static thread_local std::shared_ptr<arena>* current = nullptr;
+    return current;
+}
+
+/**
+ * Allocates a node from the arena installed on this thread, if any.
+ */
+template <class T, class... Args>
+inline std::shared_ptr<T> make_node(Args&&... args)
+{
+    if (auto a = current_arena())
+        return std::allocate_shared<T>(arena_allocator<T>{*a},
+                                       std::forward<Args>(args)...);
+    if (current_counter())
+        return std::allocate_shared<T>(counting_allocator<T>{},
+                                       std::forward<Args>(args)...);
+    return std::make_shared<T>(std::forward<Args>(args)...);
+}
+} // namespace detail
+
+/**
+ * Installs an arena for the node factories (make_value(), make_array(),
+ * make_table(), make_table_array()) on the current thread for the lifetime
+ * of the scope. Scopes nest; the previous arena is restored on exit.
+ */
+class arena_scope
+{
+  public:
+    arena_scope(std::shared_ptr<arena> a)
+        : arena_{std::move(a)}, prev_{detail::current_arena()}
+    {
+        detail::current_arena() = arena_ ? &arena_ : nullptr;
+    }
+
+    arena_scope(const arena_scope&) = delete;
+    arena_scope& operator=(const arena_scope&) = delete;
+
+    ~arena_scope()
+    {
+        detail::current_arena() = prev_;
+    }
+
+  private:
+    std::shared_ptr<arena> arena_;
+    std::shared_ptr<arena>* prev_;
+};
+
+namespace detail
+{
+struct scanner;
+}
+
+/**
+ * Options for parser, parse_file() and parse_buffer().
+ */
+struct parse_options
+{
+    /// allocate all nodes of the document from one arena
+    bool use_arena = false;
+
+    /// size of the arena chunks
+    std::size_t arena_chunk_size = 64 * 1024;
+
+    /// counts the node allocations of the parse, if set
+    allocation_counter* allocations = nullptr;
+
+    /// arrays and inline tables nested deeper than this are rejected, so
+    /// that hostile input cannot exhaust the stack
+    std::size_t max_depth = 256;
+
+    /// byte scanners of the parser, e.g. instrumented ones in tests;
+    /// nullptr: the best one for this CPU (detail::active_scanner())
+    const detail::scanner* scanner = nullptr;
+};
+
+/**
+ * Memory held by a document, see base::memory_usage().
+ */
+struct memory_usage
+{
+    /// nodes by type
+    std::size_t tables = 0;
+    std::size_t arrays = 0;
+    std::size_t table_arrays = 0;
+    std::size_t strings = 0;
+    std::size_t integers = 0;
+    std::size_t floats = 0;
+    std::size_t booleans = 0;
+    std::size_t dates = 0; ///< all four date/time types
+
+    /// characters in keys
+    std::size_t key_bytes = 0;
+
+    /// characters in string values
+    std::size_t string_bytes = 0;
+
+    /// heap blocks of keys and strings too long to be stored inline
+    std::size_t string_heap_bytes = 0;
+
+    /// the node objects themselves
+    std::size_t node_bytes = 0;
+
+    /// element storage of tables and arrays, including unused capacity
+    std::size_t container_bytes = 0;
+
+    /// shared_ptr control blocks (estimated, the layout is not portable;
+    /// those of arena nodes also hold a reference to the arena)
+    std::size_t control_block_bytes = 0;
+
+    std::size_t nodes() const
+    {
+        return tables + arrays + table_arrays + strings + integers + floats
+               + booleans + dates;
+    }
+
+    /**
+     * Bytes held by the document, not counting allocator overhead.
+     */
+    std::size_t total() const
+    {
+        return string_heap_bytes + node_bytes + container_bytes
+               + control_block_bytes;
+    }
+};
+
+#if defined(CPPTOML_NO_RTTI)
+/// Base type used to store underlying data type explicitly if RTTI is disabled
+enum class base_type
+{
+    NONE,
+    STRING,
+    LOCAL_TIME,
+    LOCAL_DATE,
+    LOCAL_DATETIME,
+    OFFSET_DATETIME,
+    INT,
+    FLOAT,
+    BOOL,
+    TABLE,
+    ARRAY,
+    TABLE_ARRAY
+};
+
+/// Type traits class to convert C++ types to enum member
+template <class T>
+struct base_type_traits;
+
+template <>
+struct base_type_traits<std::string>
 {
     static const base_type type = base_type::STRING;
 };
@@ -576,6 +1449,22 @@ class base : public std::enable_shared_from_this<base>
     template <class Visitor, class... Args>
     void accept(Visitor&& visitor, Args&&... args) const;
 
+    /**
+     * Walks this node and everything below it and reports the memory
+     * held. Strings still escaped are decoded on the way. A subtree
+     * shared by several parents is counted once per parent.
+     */
+    cpptoml::memory_usage memory_usage() const;
+
+    /**
+     * The line of the document this node was defined on, counted from 1,
+     * or 0 for nodes not read by the parser (and for the root table).
+     */
+    std::size_t line() const
+    {
+        return line_;
+    }
+
 #if defined(CPPTOML_NO_RTTI)
     base_type type() const
     {
@@ -598,37 +1487,271 @@ class base : public std::enable_shared_from_this<base>
         // nothing
     }
 #endif
+
+  private:
+    friend class parser;
+    std::size_t line_ = 0;
 };
 
+class parser;
+
+namespace detail
+{
 /**
- * A concrete TOML value representing the "leaves" of the "tree".
+ * Writes the UTF-8 encoding of a Unicode scalar value to out and returns
+ * its length (1 to 4 bytes).
  */
-template <class T>
-class value : public base
+inline std::size_t encode_utf8(uint32_t codepoint, char* out)
 {
-    struct make_shared_enabler
+    // See Table 3-6 of the Unicode standard
+    if (codepoint <= 0x7f)
     {
-        // nothing; this is a private key accessible only to friends
-    };
-
-    template <class U>
-    friend std::shared_ptr<typename value_traits<U>::type>
-    cpptoml::make_value(U&& val);
-
-  public:
-    static_assert(valid_value<T>::value, "invalid value type");
-
-    std::shared_ptr<base> clone() const override;
-
-    value(const make_shared_enabler&, const T& val) : value(val)
+        // 1-byte codepoints: 00000000 0xxxxxxx
+        // repr: 0xxxxxxx
+        out[0] = static_cast<char>(codepoint & 0x7f);
+        return 1;
+    }
+    else if (codepoint <= 0x7ff)
     {
-        // nothing; note that users cannot actually invoke this function
-        // because they lack access to the make_shared_enabler.
+        // 2-byte codepoints: 00000yyy yyxxxxxx
+        // repr: 110yyyyy 10xxxxxx
+        out[0] = static_cast<char>(0xc0 | ((codepoint >> 6) & 0x1f));
+        out[1] = static_cast<char>(0x80 | (codepoint & 0x3f));
+        return 2;
     }
-
-    bool is_value() const override
+    else if (codepoint <= 0xffff)
     {
-        return true;
+        // 3-byte codepoints: zzzzyyyy yyxxxxxx
+        // repr: 1110zzzz 10yyyyyy 10xxxxxx
+        out[0] = static_cast<char>(0xe0 | ((codepoint >> 12) & 0x0f));
+        out[1] = static_cast<char>(0x80 | ((codepoint >> 6) & 0x3f));
+        out[2] = static_cast<char>(0x80 | (codepoint & 0x3f));
+        return 3;
+    }
+    else
+    {
+        // 4-byte codepoints: 000uuuuu zzzzyyyy yyxxxxxx
+        // repr: 11110uuu 10uuzzzz 10yyyyyy 10xxxxxx
+        out[0] = static_cast<char>(0xf0 | ((codepoint >> 18) & 0x07));
+        out[1] = static_cast<char>(0x80 | ((codepoint >> 12) & 0x3f));
+        out[2] = static_cast<char>(0x80 | ((codepoint >> 6) & 0x3f));
+        out[3] = static_cast<char>(0x80 | (codepoint & 0x3f));
+        return 4;
+    }
+}
+
+/**
+ * Decodes the escape sequences of a basic string in place. The decoded
+ * form is never longer than the escaped one, so this does not allocate.
+ * The escape sequences must have been validated by the parser.
+ */
+inline void unescape_in_place(std::string& s)
+{
+    char* buf = &s[0];
+    std::size_t size = s.size();
+    auto first = static_cast<const char*>(std::memchr(buf, '\\', size));
+    if (!first)
+        return;
+
+    std::size_t r = static_cast<std::size_t>(first - buf);
+    std::size_t w = r;
+    while (r < size)
+    {
+        // copy plain content up to the next escape at once
+        auto next = static_cast<const char*>(
+            std::memchr(buf + r, '\\', size - r));
+        std::size_t stop = next ? static_cast<std::size_t>(next - buf) : size;
+        std::memmove(buf + w, buf + r, stop - r);
+        w += stop - r;
+        r = stop;
+        if (r == size)
+            break;
+
+        char c = buf[r + 1];
+        r += 2;
+        switch (c)
+        {
+            case 'b':
+                buf[w++] = '\b';
+                break;
+            case 't':
+                buf[w++] = '\t';
+                break;
+            case 'n':
+                buf[w++] = '\n';
+                break;
+            case 'f':
+                buf[w++] = '\f';
+                break;
+            case 'r':
+                buf[w++] = '\r';
+                break;
+            case 'u':
+            case 'U':
+            {
+                uint32_t codepoint = 0;
+                for (int i = c == 'u' ? 4 : 8; i > 0; --i)
+                {
+                    char h = buf[r++];
+                    codepoint = codepoint * 16
+                                + static_cast<uint32_t>(
+                                      h <= '9' ? h - '0'
+                                               : (h | 0x20) - 'a' + 10);
+                }
+                w += encode_utf8(codepoint, buf + w);
+                break;
+            }
+            default:
+                // '"' and '\\'
+                buf[w++] = c;
+                break;
+        }
+    }
+    s.resize(w);
+}
+
+/**
+ * Storage of the data of a value.
+ */
+template <class T>
+class value_data
+{
+  public:
+    value_data(const T& val) : data_(val)
+    {
+        // nothing
+    }
+
+    value_data(T&& val) : data_(std::move(val))
+    {
+        // nothing
+    }
+
+    T& get()
+    {
+        return data_;
+    }
+
+    const T& get() const
+    {
+        return data_;
+    }
+
+  private:
+    T data_;
+};
+
+/**
+ * A string parsed from a basic string with escape sequences keeps the
+ * escaped text and decodes it in place on first access. Concurrent first
+ * accesses through a shared const tree are safe: one thread decodes, the
+ * others wait for it.
+ */
+template <>
+class value_data<std::string>
+{
+  public:
+    value_data(const std::string& val) : data_(val)
+    {
+        // nothing
+    }
+
+    value_data(std::string&& val) : data_(std::move(val))
+    {
+        // nothing
+    }
+
+    std::string& get()
+    {
+        decode();
+        return data_;
+    }
+
+    const std::string& get() const
+    {
+        decode();
+        return data_;
+    }
+
+    /**
+     * Marks the data as still escaped. Only valid before the value is
+     * shared.
+     */
+    void set_escaped()
+    {
+        state_.store(escaped, std::memory_order_relaxed);
+    }
+
+  private:
+    enum : uint8_t
+    {
+        plain,
+        escaped,
+        decoding
+    };
+
+    void decode() const
+    {
+        if (state_.load(std::memory_order_acquire) != plain)
+            decode_slow();
+    }
+
+    void decode_slow() const
+    {
+        uint8_t expected = escaped;
+        if (state_.compare_exchange_strong(expected, decoding,
+                                           std::memory_order_acquire))
+        {
+            unescape_in_place(data_);
+            state_.store(plain, std::memory_order_release);
+            return;
+        }
+
+        while (state_.load(std::memory_order_acquire) != plain)
+            std::this_thread::yield();
+    }
+
+    mutable std::string data_;
+    mutable std::atomic<uint8_t> state_{plain};
+};
+} // namespace detail
+
+/**
+ * A concrete TOML value representing the "leaves" of the "tree".
+ */
+template <class T>
+class value : public base
+{
+    struct make_shared_enabler
+    {
+        // nothing; this is a private key accessible only to friends
+    };
+
+    template <class U>
+    friend std::shared_ptr<typename value_traits<U>::type>
+    cpptoml::make_value(U&& val);
+
+    friend class parser;
+
+  public:
+    static_assert(valid_value<T>::value, "invalid value type");
+
+    std::shared_ptr<base> clone() const override;
+
+    value(const make_shared_enabler&, const T& val) : value(val)
+    {
+        // nothing; note that users cannot actually invoke this function
+        // because they lack access to the make_shared_enabler.
+    }
+
+    value(const make_shared_enabler&, T&& val) : value(std::move(val))
+    {
+        // nothing
+    }
+
+    bool is_value() const override
+    {
+        return true;
     }
 
     /**
@@ -636,7 +1759,7 @@ class value : public base
      */
     T& get()
     {
-        return data_;
+        return data_.get();
     }
 
     /**
@@ -644,11 +1767,11 @@ class value : public base
      */
     const T& get() const
     {
-        return data_;
+        return data_.get();
     }
 
   private:
-    T data_;
+    detail::value_data<T> data_;
 
     /**
      * Constructs a value from the given data.
@@ -657,10 +1780,18 @@ class value : public base
     value(const T& val) : base(base_type_traits<T>::type), data_(val)
     {
     }
+
+    value(T&& val) : base(base_type_traits<T>::type), data_(std::move(val))
+    {
+    }
 #else
     value(const T& val) : data_(val)
     {
     }
+
+    value(T&& val) : data_(std::move(val))
+    {
+    }
 #endif
 
     value(const value& val) = delete;
@@ -672,7 +1803,7 @@ std::shared_ptr<typename value_traits<T>::type> make_value(T&& val)
 {
     using value_type = typename value_traits<T>::type;
     using enabler = typename value_type::make_shared_enabler;
-    return std::make_shared<value_type>(
+    return detail::make_node<value_type>(
         enabler{}, value_traits<T>::construct(std::forward<T>(val)));
 }
 
@@ -1028,7 +2159,7 @@ inline std::shared_ptr<array> make_array()
         }
     };
 
-    return std::make_shared<make_shared_enabler>();
+    return detail::make_node<make_shared_enabler>();
 }
 
 namespace detail
@@ -1200,7 +2331,7 @@ inline std::shared_ptr<table_array> make_table_array(bool is_inline)
         }
     };
 
-    return std::make_shared<make_shared_enabler>(is_inline);
+    return detail::make_node<make_shared_enabler>(is_inline);
 }
 
 namespace detail
@@ -1278,6 +2409,11 @@ get_impl(const std::shared_ptr<base>& elem)
     }
 }
 
+namespace detail
+{
+class memory_visitor;
+}
+
 /**
  * Represents a TOML keytable.
  */
@@ -1285,6 +2421,8 @@ class table : public base
 {
   public:
     friend class table_array;
+    friend class path_cache;
+    friend class detail::memory_visitor;
     friend std::shared_ptr<table> make_table();
 
     std::shared_ptr<base> clone() const override;
@@ -1299,8 +2437,13 @@ class table : public base
      */
     using const_iterator = string_to_base_map::const_iterator;
 
+    /**
+     * A mutable iterator may replace entries, so taking one counts as a
+     * change of this table (see path_cache).
+     */
     iterator begin()
     {
+        ++generation_;
         return map_.begin();
     }
 
@@ -1311,6 +2454,7 @@ class table : public base
 
     iterator end()
     {
+        ++generation_;
         return map_.end();
     }
 
@@ -1347,6 +2491,14 @@ class table : public base
         return resolve_qualified(key);
     }
 
+    /**
+     * Determines if this key table contains the given precompiled path.
+     */
+    bool contains_qualified(const path& key) const
+    {
+        return find_qualified(key) != nullptr;
+    }
+
     /**
      * Obtains the base for a given key.
      * @throw std::out_of_range if the key does not exist
@@ -1370,6 +2522,18 @@ class table : public base
         return p;
     }
 
+    /**
+     * Obtains the base for a given precompiled path.
+     *
+     * @throw std::out_of_range if the key does not exist
+     */
+    std::shared_ptr<base> get_qualified(const path& key) const
+    {
+        if (auto p = find_qualified(key))
+            return *p;
+        throw std::out_of_range{key.str() + " is not a valid key"};
+    }
+
     /**
      * Obtains a table for a given key, if possible.
      */
@@ -1391,6 +2555,14 @@ class table : public base
         return nullptr;
     }
 
+    std::shared_ptr<table> get_table_qualified(const path& key) const
+    {
+        auto p = find_qualified(key);
+        if (p && (*p)->is_table())
+            return std::static_pointer_cast<table>(*p);
+        return nullptr;
+    }
+
     /**
      * Obtains an array for a given key.
      */
@@ -1411,6 +2583,12 @@ class table : public base
         return get_qualified(key)->as_array();
     }
 
+    std::shared_ptr<array> get_array_qualified(const path& key) const
+    {
+        auto p = find_qualified(key);
+        return p ? (*p)->as_array() : nullptr;
+    }
+
     /**
      * Obtains a table_array for a given key, if possible.
      */
@@ -1433,6 +2611,12 @@ class table : public base
         return get_qualified(key)->as_table_array();
     }
 
+    std::shared_ptr<table_array> get_table_array_qualified(const path& key) const
+    {
+        auto p = find_qualified(key);
+        return p ? (*p)->as_table_array() : nullptr;
+    }
+
     /**
      * Helper function that attempts to get a value corresponding
      * to the template parameter from a given key.
@@ -1468,6 +2652,18 @@ class table : public base
         }
     }
 
+    /**
+     * Helper function that attempts to get a value corresponding
+     * to the template parameter from a given precompiled path.
+     */
+    template <class T>
+    option<T> get_qualified_as(const path& key) const
+    {
+        if (auto p = find_qualified(key))
+            return get_impl<T>(*p);
+        return {};
+    }
+
     /**
      * Helper function that attempts to get an array of values of a given
      * type corresponding to the template parameter for a given key.
@@ -1537,6 +2733,7 @@ class table : public base
     void insert(const std::string& key, const std::shared_ptr<base>& value)
     {
         map_[key] = value;
+        ++generation_;
     }
 
     /**
@@ -1555,7 +2752,8 @@ class table : public base
      */
     void erase(const std::string& key)
     {
-        map_.erase(key);
+        if (map_.erase(key))
+            ++generation_;
     }
 
   private:
@@ -1621,7 +2819,32 @@ class table : public base
         return true;
     }
 
+    // Returns the entry for a precompiled path, or nullptr. Walks the
+    // tables with the precomputed hashes and copies no shared_ptr.
+    const std::shared_ptr<base>* find_qualified(const path& key) const
+    {
+        if (key.size() == 0)
+            return nullptr;
+
+        auto cur_table = this;
+        auto last = key.end() - 1;
+        for (auto it = key.begin();; ++it)
+        {
+            auto found = detail::find_key(cur_table->map_, it->key, it->hash);
+            if (found == cur_table->map_.end())
+                return nullptr;
+            if (it == last)
+                return &found->second;
+            if (!found->second->is_table())
+                return nullptr;
+            cur_table = static_cast<const table*>(found->second.get());
+        }
+    }
+
     string_to_base_map map_;
+
+    // changes of map_, checked by path_cache
+    uint64_t generation_ = 0;
 };
 
 /**
@@ -1698,7 +2921,7 @@ std::shared_ptr<table> make_table()
         }
     };
 
-    return std::make_shared<make_shared_enabler>();
+    return detail::make_node<make_shared_enabler>();
 }
 
 namespace detail
@@ -1713,7 +2936,7 @@ inline std::shared_ptr<table> make_element<table>()
 template <class T>
 std::shared_ptr<base> value<T>::clone() const
 {
-    return make_value(data_);
+    return make_value(get());
 }
 
 inline std::shared_ptr<base> array::clone() const
@@ -1742,6 +2965,103 @@ inline std::shared_ptr<base> table::clone() const
     return result;
 }
 
+/**
+ * Memoizes path lookups on one table:
+ *
+ *     static const cpptoml::path layer{"ilm.layer"};
+ *     cpptoml::path_cache cache{config};
+ *     auto v = cache.get_as<int64_t>(layer);
+ *
+ * A cached result remembers the generation of every table on its path and
+ * is reused until one of them changes (insert, erase, or a mutable
+ * iterator taken). Changes anywhere else in the tree, or in other trees,
+ * leave it valid. A cache is not safe to share between threads.
+ */
+class path_cache
+{
+  public:
+    path_cache(std::shared_ptr<const table> root) : root_(std::move(root))
+    {
+        // nothing
+    }
+
+    /**
+     * Obtains the base for a given path, or nullptr if it does not exist.
+     */
+    std::shared_ptr<base> get(const path& key)
+    {
+        auto& e = entries_[key.id()];
+        if (!e.valid || !e.current())
+            lookup(key, e);
+        return e.node;
+    }
+
+    template <class T>
+    option<T> get_as(const path& key)
+    {
+        if (auto node = get(key))
+            return get_impl<T>(node);
+        return {};
+    }
+
+    void clear()
+    {
+        entries_.clear();
+    }
+
+  private:
+    struct entry
+    {
+        // tables walked from the root, with their generation at lookup
+        std::vector<std::pair<const table*, uint64_t>> tables;
+        bool valid = false;
+        std::shared_ptr<base> node;
+
+        // checked from the root down: an unchanged table still owns the
+        // next one, so no pointer is followed into a released table
+        bool current() const
+        {
+            for (const auto& t : tables)
+            {
+                if (t.first->generation_ != t.second)
+                    return false;
+            }
+            return true;
+        }
+    };
+
+    // table::find_qualified(), recording the tables walked
+    void lookup(const path& key, entry& e) const
+    {
+        e.tables.clear();
+        e.node = nullptr;
+        e.valid = true;
+        if (key.size() == 0)
+            return;
+
+        const table* cur_table = root_.get();
+        auto last = key.end() - 1;
+        for (auto it = key.begin();; ++it)
+        {
+            e.tables.emplace_back(cur_table, cur_table->generation_);
+            auto found = detail::find_key(cur_table->map_, it->key, it->hash);
+            if (found == cur_table->map_.end())
+                return;
+            if (it == last)
+            {
+                e.node = found->second;
+                return;
+            }
+            if (!found->second->is_table())
+                return;
+            cur_table = static_cast<const table*>(found->second.get());
+        }
+    }
+
+    std::shared_ptr<const table> root_;
+    std::unordered_map<uint64_t, entry> entries_;
+};
+
 /**
  * Exception class for all TOML parsing errors.
  */
@@ -1758,47 +3078,402 @@ class parse_exception : public std::runtime_error
     }
 };
 
-inline bool is_number(char c)
-{
-    return c >= '0' && c <= '9';
-}
-
-inline bool is_hex(char c)
-{
-    return is_number(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
-}
-
 /**
- * Helper object for consuming expected characters.
+ * Receiver of the events of a streaming parse (parser::parse(event_handler&),
+ * stream_file(), stream_buffer()). All callbacks default to doing nothing.
+ *
+ * For every key/value pair, key() is called with the (possibly dotted) key
+ * split into its components, followed by the events of the value: a single
+ * value() for scalars, begin_array()/end_array() around the elements of an
+ * array (including arrays of inline tables), and
+ * begin_inline_table()/end_inline_table() around the key() and value events
+ * of an inline table.
+ *
+ * Only the value being reported is held in memory, so the footprint does
+ * not grow with the document. In exchange, checks that need the whole tree
+ * (duplicate keys, redefined tables) are not performed.
  */
-template <class OnError>
-class consumer
+class event_handler
 {
   public:
-    consumer(std::string::iterator& it, const std::string::iterator& end,
-             OnError&& on_error)
-        : it_(it), end_(end), on_error_(std::forward<OnError>(on_error))
+    virtual ~event_handler() = default;
+
+    /// [a.b]
+    virtual void table_header(const std::vector<std::string>&)
     {
-        // nothing
     }
 
-    void operator()(char c)
+    /// [[a.b]]
+    virtual void table_array_header(const std::vector<std::string>&)
     {
-        if (it_ == end_ || *it_ != c)
-            on_error_();
-        ++it_;
     }
 
-    template <std::size_t N>
-    void operator()(const char (&str)[N])
+    virtual void key(const std::vector<std::string>&)
     {
-        std::for_each(std::begin(str), std::end(str) - 1,
-                      [&](char c) { (*this)(c); });
     }
 
-    void eat_or(char a, char b)
+    virtual void value(const std::string&)
     {
-        if (it_ == end_ || (*it_ != a && *it_ != b))
+    }
+
+    virtual void value(int64_t)
+    {
+    }
+
+    virtual void value(double)
+    {
+    }
+
+    virtual void value(bool)
+    {
+    }
+
+    virtual void value(const local_date&)
+    {
+    }
+
+    virtual void value(const local_time&)
+    {
+    }
+
+    virtual void value(const local_datetime&)
+    {
+    }
+
+    virtual void value(const offset_datetime&)
+    {
+    }
+
+    virtual void begin_array()
+    {
+    }
+
+    virtual void end_array()
+    {
+    }
+
+    virtual void begin_inline_table()
+    {
+    }
+
+    virtual void end_inline_table()
+    {
+    }
+};
+
+namespace detail
+{
+/**
+ * Visitor replaying a parsed value as events.
+ */
+class event_emitter
+{
+  public:
+    event_emitter(event_handler& handler) : handler_(handler)
+    {
+        // nothing
+    }
+
+    template <class T>
+    void visit(const value<T>& v)
+    {
+        handler_.value(v.get());
+    }
+
+    void visit(const array& arr)
+    {
+        handler_.begin_array();
+        for (const auto& v : arr)
+            v->accept(*this);
+        handler_.end_array();
+    }
+
+    void visit(const table& tbl)
+    {
+        handler_.begin_inline_table();
+        for (const auto& p : tbl)
+        {
+            key_.assign(1, p.first);
+            handler_.key(key_);
+            p.second->accept(*this);
+        }
+        handler_.end_inline_table();
+    }
+
+    void visit(const table_array& tarr)
+    {
+        handler_.begin_array();
+        for (const auto& t : tarr)
+            visit(*t);
+        handler_.end_array();
+    }
+
+  private:
+    event_handler& handler_;
+    std::vector<std::string> key_;
+};
+} // namespace detail
+
+/**
+ * The parser walks its input with plain pointers, either into the current
+ * line of a stream or directly into a caller-supplied buffer.
+ */
+using char_iterator = const char*;
+
+inline bool is_number(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+inline bool is_hex(char c)
+{
+    return is_number(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+namespace detail
+{
+/**
+ * Byte scanners used by the parser's hot loops:
+ *
+ *  - skip_blank() returns the first byte in [it, end) that is not ' ' or
+ *    '\t';
+ *  - find_string_special() returns the first byte that ends a run of plain
+ *    string content: the delimiter, or a backslash when the delimiter is
+ *    '"' (escapes are not recognized in literal strings).
+ *
+ * Both return end if there is no such byte. The vector versions examine
+ * 16 (SSE2, NEON) or 32 (AVX2) bytes at a time and finish the tail with
+ * the scalar version, so all of them return exactly the same pointer.
+ * The implementation is picked once at runtime (see active_scanner()).
+ */
+enum class simd_level
+{
+    scalar,
+    sse2,
+    avx2,
+    neon
+};
+
+struct scanner
+{
+    simd_level level;
+    const char* (*skip_blank)(const char* it, const char* end);
+    const char* (*find_string_special)(const char* it, const char* end,
+                                       char delim);
+};
+
+inline const char* skip_blank_scalar(const char* it, const char* end)
+{
+    while (it != end && (*it == ' ' || *it == '\t'))
+        ++it;
+    return it;
+}
+
+inline const char* find_string_special_scalar(const char* it,
+                                              const char* end, char delim)
+{
+    if (delim == '"')
+    {
+        while (it != end && *it != '"' && *it != '\\')
+            ++it;
+        return it;
+    }
+    while (it != end && *it != delim)
+        ++it;
+    return it;
+}
+
+#if defined(CPPTOML_HAS_SSE2)
+inline const char* skip_blank_sse2(const char* it, const char* end)
+{
+    const __m128i sp = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    while (end - it >= 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(it));
+        __m128i blank
+            = _mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_cmpeq_epi8(v, tab));
+        unsigned mask = ~static_cast<unsigned>(_mm_movemask_epi8(blank))
+                        & 0xffffu;
+        if (mask)
+            return it + __builtin_ctz(mask);
+        it += 16;
+    }
+    return skip_blank_scalar(it, end);
+}
+
+inline const char* find_string_special_sse2(const char* it, const char* end,
+                                            char delim)
+{
+    const __m128i d = _mm_set1_epi8(delim);
+    // a literal string has no escapes: compare against the delimiter twice
+    const __m128i bs = _mm_set1_epi8(delim == '"' ? '\\' : delim);
+    while (end - it >= 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(it));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(v, d), _mm_cmpeq_epi8(v, bs))));
+        if (mask)
+            return it + __builtin_ctz(mask);
+        it += 16;
+    }
+    return find_string_special_scalar(it, end, delim);
+}
+#endif
+
+#if defined(CPPTOML_HAS_AVX2)
+__attribute__((target("avx2"))) inline const char*
+skip_blank_avx2(const char* it, const char* end)
+{
+    const __m256i sp = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    while (end - it >= 32)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(it));
+        __m256i blank = _mm256_or_si256(_mm256_cmpeq_epi8(v, sp),
+                                        _mm256_cmpeq_epi8(v, tab));
+        unsigned mask
+            = ~static_cast<unsigned>(_mm256_movemask_epi8(blank));
+        if (mask)
+            return it + __builtin_ctz(mask);
+        it += 32;
+    }
+    return skip_blank_sse2(it, end);
+}
+
+__attribute__((target("avx2"))) inline const char*
+find_string_special_avx2(const char* it, const char* end, char delim)
+{
+    const __m256i d = _mm256_set1_epi8(delim);
+    const __m256i bs = _mm256_set1_epi8(delim == '"' ? '\\' : delim);
+    while (end - it >= 32)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(it));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, d),
+                            _mm256_cmpeq_epi8(v, bs))));
+        if (mask)
+            return it + __builtin_ctz(mask);
+        it += 32;
+    }
+    return find_string_special_sse2(it, end, delim);
+}
+#endif
+
+#if defined(CPPTOML_HAS_NEON)
+/**
+ * Index of the first set byte of a 0x00/0xff comparison result, or 16.
+ */
+inline unsigned first_set_neon(uint8x16_t m)
+{
+    // narrow each byte to a nibble: 64 bits for 16 lanes
+    uint8x8_t n = vshrn_n_u16(vreinterpretq_u16_u8(m), 4);
+    uint64_t bits = vget_lane_u64(vreinterpret_u64_u8(n), 0);
+    return bits ? static_cast<unsigned>(__builtin_ctzll(bits)) >> 2 : 16;
+}
+
+inline const char* skip_blank_neon(const char* it, const char* end)
+{
+    const uint8x16_t sp = vdupq_n_u8(' ');
+    const uint8x16_t tab = vdupq_n_u8('\t');
+    while (end - it >= 16)
+    {
+        uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t*>(it));
+        uint8x16_t other
+            = vmvnq_u8(vorrq_u8(vceqq_u8(v, sp), vceqq_u8(v, tab)));
+        unsigned i = first_set_neon(other);
+        if (i < 16)
+            return it + i;
+        it += 16;
+    }
+    return skip_blank_scalar(it, end);
+}
+
+inline const char* find_string_special_neon(const char* it, const char* end,
+                                            char delim)
+{
+    const uint8x16_t d = vdupq_n_u8(static_cast<uint8_t>(delim));
+    const uint8x16_t bs
+        = vdupq_n_u8(static_cast<uint8_t>(delim == '"' ? '\\' : delim));
+    while (end - it >= 16)
+    {
+        uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t*>(it));
+        unsigned i = first_set_neon(vorrq_u8(vceqq_u8(v, d), vceqq_u8(v, bs)));
+        if (i < 16)
+            return it + i;
+        it += 16;
+    }
+    return find_string_special_scalar(it, end, delim);
+}
+#endif
+
+/**
+ * The scanner for a given level. Levels that are not compiled in (or, for
+ * AVX2, not supported by the CPU) fall back to the best available one.
+ */
+inline scanner make_scanner(simd_level level)
+{
+#if defined(CPPTOML_HAS_AVX2)
+    if (level == simd_level::avx2 && __builtin_cpu_supports("avx2"))
+        return {simd_level::avx2, skip_blank_avx2, find_string_special_avx2};
+#endif
+#if defined(CPPTOML_HAS_SSE2)
+    if (level == simd_level::sse2 || level == simd_level::avx2)
+        return {simd_level::sse2, skip_blank_sse2, find_string_special_sse2};
+#endif
+#if defined(CPPTOML_HAS_NEON)
+    if (level == simd_level::neon)
+        return {simd_level::neon, skip_blank_neon, find_string_special_neon};
+#endif
+    (void)level;
+    return {simd_level::scalar, skip_blank_scalar,
+            find_string_special_scalar};
+}
+
+inline const scanner& active_scanner()
+{
+#if defined(CPPTOML_HAS_AVX2)
+    static const scanner s = make_scanner(simd_level::avx2);
+#elif defined(CPPTOML_HAS_NEON)
+    static const scanner s = make_scanner(simd_level::neon);
+#else
+    static const scanner s = make_scanner(simd_level::scalar);
+#endif
+    return s;
+}
+} // namespace detail
+
+/**
+ * Helper object for consuming expected characters.
+ */
+template <class OnError>
+class consumer
+{
+  public:
+    consumer(char_iterator& it, const char_iterator& end,
+             OnError&& on_error)
+        : it_(it), end_(end), on_error_(std::forward<OnError>(on_error))
+    {
+        // nothing
+    }
+
+    void operator()(char c)
+    {
+        if (it_ == end_ || *it_ != c)
+            on_error_();
+        ++it_;
+    }
+
+    template <std::size_t N>
+    void operator()(const char (&str)[N])
+    {
+        std::for_each(std::begin(str), std::end(str) - 1,
+                      [&](char c) { (*this)(c); });
+    }
+
+    void eat_or(char a, char b)
+    {
+        if (it_ == end_ || (*it_ != a && *it_ != b))
             on_error_();
         ++it_;
     }
@@ -1808,7 +3483,7 @@ class consumer
         int val = 0;
         for (int i = 0; i < len; ++i)
         {
-            if (!is_number(*it_) || it_ == end_)
+            if (it_ == end_ || !is_number(*it_))
                 on_error_();
             val = 10 * val + (*it_++ - '0');
         }
@@ -1821,52 +3496,126 @@ class consumer
     }
 
   private:
-    std::string::iterator& it_;
-    const std::string::iterator& end_;
+    char_iterator& it_;
+    const char_iterator& end_;
     OnError on_error_;
 };
 
 template <class OnError>
-consumer<OnError> make_consumer(std::string::iterator& it,
-                                const std::string::iterator& end,
+consumer<OnError> make_consumer(char_iterator& it,
+                                const char_iterator& end,
                                 OnError&& on_error)
 {
     return consumer<OnError>(it, end, std::forward<OnError>(on_error));
 }
 
-// replacement for std::getline to handle incorrectly line-ended files
-// https://stackoverflow.com/questions/6089231/getting-std-ifstream-to-handle-lf-cr-and-crlf
 namespace detail
 {
-inline std::istream& getline(std::istream& input, std::string& line)
+/**
+ * Splits a stream into lines for the parser. The stream is read in large
+ * blocks and line endings are found with memchr(), so lines are handed
+ * out as views into the block (valid until the next call) instead of
+ * being copied character by character. A line longer than the block
+ * grows it.
+ *
+ * Lines end at \n or \r\n, exactly like the lines of a buffer given to
+ * the parser, and one last empty line is returned at the end of the
+ * input.
+ */
+class line_reader
 {
-    line.clear();
+  public:
+    line_reader()
+    {
+        // nothing
+    }
+
+    explicit line_reader(std::istream& input,
+                         std::size_t block_size = 64 * 1024)
+        : input_(&input), block_(block_size)
+    {
+        // nothing
+    }
 
-    std::istream::sentry sentry{input, true};
-    auto sb = input.rdbuf();
+    bool is_open() const
+    {
+        return input_ != nullptr;
+    }
 
-    while (true)
+    bool next(const char*& begin, const char*& end)
     {
-        auto c = sb->sbumpc();
-        if (c == '\r')
+        const char* nl = find_newline();
+        while (!nl && !eof_)
         {
-            if (sb->sgetc() == '\n')
-                c = sb->sbumpc();
+            fill();
+            nl = find_newline();
         }
 
-        if (c == '\n')
-            return input;
+        const char* data = block_.data();
+        begin = data + cur_;
+        if (nl)
+        {
+            end = (nl != begin && nl[-1] == '\r') ? nl - 1 : nl;
+            cur_ = scan_ = static_cast<std::size_t>(nl - data) + 1;
+            return true;
+        }
 
-        if (c == std::istream::traits_type::eof())
+        // the rest of the input, then one empty line
+        if (cur_ == end_)
         {
-            if (line.empty())
-                input.setstate(std::ios::eofbit);
-            return input;
+            if (done_)
+                return false;
+            done_ = true;
         }
+        end = data + end_;
+        cur_ = scan_ = end_;
+        return true;
+    }
+
+  private:
+    const char* find_newline()
+    {
+        if (scan_ == end_)
+            return nullptr;
 
-        line.push_back(static_cast<char>(c));
+        const char* data = block_.data();
+        auto nl = static_cast<const char*>(
+            std::memchr(data + scan_, '\n', end_ - scan_));
+        if (!nl)
+            scan_ = end_;
+        return nl;
     }
-}
+
+    /**
+     * Moves the partial line to the front of the block and reads more.
+     */
+    void fill()
+    {
+        if (cur_ > 0)
+        {
+            std::memmove(block_.data(), block_.data() + cur_, end_ - cur_);
+            end_ -= cur_;
+            scan_ -= cur_;
+            cur_ = 0;
+        }
+        if (end_ == block_.size())
+            block_.resize(block_.size() * 2);
+
+        input_->read(block_.data() + end_,
+                     static_cast<std::streamsize>(block_.size() - end_));
+        end_ += static_cast<std::size_t>(input_->gcount());
+        if (!*input_)
+            eof_ = true;
+    }
+
+    std::istream* input_ = nullptr;
+    std::vector<char> block_;
+    std::size_t cur_ = 0;  // start of the next line
+    std::size_t scan_ = 0; // searched for \n up to here
+    std::size_t end_ = 0;  // end of the data read
+    bool eof_ = false;     // nothing more to read
+    bool done_ = false;    // final empty line returned
+};
 } // namespace detail
 
 /**
@@ -1878,7 +3627,20 @@ class parser
     /**
      * Parsers are constructed from streams.
      */
-    parser(std::istream& stream) : input_(stream)
+    parser(std::istream& stream, const parse_options& options = {})
+        : reader_(stream), options_(options)
+    {
+        // nothing
+    }
+
+    /**
+     * Parsers can also be constructed from a contiguous buffer, which must
+     * outlive the call to parse(). Lines are handed to the parser as views
+     * into the buffer, so no per-line copy is made.
+     */
+    parser(const char* begin, const char* end,
+           const parse_options& options = {})
+        : buf_cur_(begin), buf_end_(end), options_(options)
     {
         // nothing
     }
@@ -1891,15 +3653,20 @@ class parser
      */
     std::shared_ptr<table> parse()
     {
+        arena_scope scope{options_.use_arena ? std::make_shared<arena>(
+                                                   options_.arena_chunk_size)
+                                             : nullptr};
+        allocation_scope counting{options_.allocations};
+
         std::shared_ptr<table> root = make_table();
 
         table* curr_table = root.get();
 
-        while (detail::getline(input_, line_))
+        char_iterator it;
+        char_iterator end;
+        while (next_line(it, end))
         {
             line_number_++;
-            auto it = line_.begin();
-            auto end = line_.end();
             consume_whitespace(it, end);
             if (it == end || *it == '#')
                 continue;
@@ -1918,7 +3685,76 @@ class parser
         return root;
     }
 
+    /**
+     * Parses the input in a single pass, reporting its contents to the
+     * given handler instead of building a tree.
+     * @throw parse_exception if there are errors in parsing
+     */
+    void parse(event_handler& handler)
+    {
+        arena_scope scope{options_.use_arena ? std::make_shared<arena>(
+                                                   options_.arena_chunk_size)
+                                             : nullptr};
+        allocation_scope counting{options_.allocations};
+
+        char_iterator it;
+        char_iterator end;
+        while (next_line(it, end))
+        {
+            line_number_++;
+            consume_whitespace(it, end);
+            if (it == end || *it == '#')
+                continue;
+            if (*it == '[')
+            {
+                stream_table(it, end, handler);
+            }
+            else
+            {
+                stream_key_value(it, end, handler);
+                consume_whitespace(it, end);
+                eol_or_comment(it, end);
+            }
+        }
+    }
+
   private:
+    /**
+     * Fetches the next line (without its line ending) from the stream or
+     * buffer. Lines end at \n or \r\n, exactly like detail::line_reader,
+     * which also yields one last empty line at the end of the input.
+     */
+    bool next_line(char_iterator& begin, char_iterator& end)
+    {
+        if (reader_.is_open())
+            return reader_.next(begin, end);
+
+        if (buf_cur_ == buf_end_)
+        {
+            if (buf_eof_)
+                return false;
+            buf_eof_ = true;
+            begin = end = buf_end_;
+            return true;
+        }
+
+        auto len = static_cast<std::size_t>(buf_end_ - buf_cur_);
+        auto nl = static_cast<const char*>(std::memchr(buf_cur_, '\n', len));
+
+        begin = buf_cur_;
+        if (nl)
+        {
+            end = (nl != begin && nl[-1] == '\r') ? nl - 1 : nl;
+            buf_cur_ = nl + 1;
+        }
+        else
+        {
+            end = buf_end_;
+            buf_cur_ = buf_end_;
+        }
+        return true;
+    }
+
 #if defined _MSC_VER
     __declspec(noreturn)
 #elif defined __GNUC__
@@ -1929,22 +3765,55 @@ class parser
         throw parse_exception{err, line_number_};
     }
 
-    void parse_table(std::string::iterator& it,
-                     const std::string::iterator& end, table*& curr_table)
+    /**
+     * Records the current line as the line the node is defined on.
+     */
+    template <class T>
+    std::shared_ptr<T> at_line(std::shared_ptr<T> node)
     {
-        // remove the beginning keytable marker
-        ++it;
-        if (it == end)
-            throw_parse_exception("Unexpected end of table");
-        if (*it == '[')
-            parse_table_array(it, end, curr_table);
-        else
-            parse_single_table(it, end, curr_table);
+        node->line_ = line_number_;
+        return node;
     }
 
-    void parse_single_table(std::string::iterator& it,
-                            const std::string::iterator& end,
-                            table*& curr_table)
+    /**
+     * Counts the arrays and inline tables being parsed, see
+     * parse_options::max_depth.
+     */
+    class depth_guard
+    {
+      public:
+        depth_guard(parser& p) : p_(p)
+        {
+            if (++p_.depth_ > p_.options_.max_depth)
+                p_.throw_parse_exception(
+                    "Arrays and inline tables nested too deeply");
+        }
+
+        ~depth_guard()
+        {
+            --p_.depth_;
+        }
+
+      private:
+        parser& p_;
+    };
+
+    void parse_table(char_iterator& it,
+                     const char_iterator& end, table*& curr_table)
+    {
+        // remove the beginning keytable marker
+        ++it;
+        if (it == end)
+            throw_parse_exception("Unexpected end of table");
+        if (*it == '[')
+            parse_table_array(it, end, curr_table);
+        else
+            parse_single_table(it, end, curr_table);
+    }
+
+    void parse_single_table(char_iterator& it,
+                            const char_iterator& end,
+                            table*& curr_table)
     {
         if (it == end || *it == ']')
             throw_parse_exception("Table name cannot be empty");
@@ -1984,7 +3853,7 @@ class parser
             else
             {
                 inserted = true;
-                curr_table->insert(part, make_table());
+                curr_table->insert(part, at_line(make_table()));
                 curr_table = static_cast<table*>(curr_table->get(part).get());
             }
         };
@@ -2031,8 +3900,8 @@ class parser
         eol_or_comment(it, end);
     }
 
-    void parse_table_array(std::string::iterator& it,
-                           const std::string::iterator& end, table*& curr_table)
+    void parse_table_array(char_iterator& it,
+                           const char_iterator& end, table*& curr_table)
     {
         ++it;
         if (it == end || *it == ']')
@@ -2077,7 +3946,7 @@ class parser
                                               + " cannot be appended to");
                     }
 
-                    v->get().push_back(make_table());
+                    v->get().push_back(at_line(make_table()));
                     curr_table = v->get().back().get();
                 }
                 // otherwise, just keep traversing down the key name
@@ -2102,17 +3971,17 @@ class parser
                 // add keys to next
                 if (it != end && *it == ']')
                 {
-                    curr_table->insert(part, make_table_array());
+                    curr_table->insert(part, at_line(make_table_array()));
                     auto arr = std::static_pointer_cast<table_array>(
                         curr_table->get(part));
-                    arr->get().push_back(make_table());
+                    arr->get().push_back(at_line(make_table()));
                     curr_table = arr->get().back().get();
                 }
                 // otherwise, create the implicitly defined table and move
                 // down to it
                 else
                 {
-                    curr_table->insert(part, make_table());
+                    curr_table->insert(part, at_line(make_table()));
                     curr_table
                         = static_cast<table*>(curr_table->get(part).get());
                 }
@@ -2132,7 +4001,75 @@ class parser
         eol_or_comment(it, end);
     }
 
-    void parse_key_value(std::string::iterator& it, std::string::iterator& end,
+    void stream_table(char_iterator& it, const char_iterator& end,
+                      event_handler& handler)
+    {
+        // remove the beginning keytable marker
+        ++it;
+        if (it == end)
+            throw_parse_exception("Unexpected end of table");
+
+        bool is_array = *it == '[';
+        if (is_array)
+            ++it;
+        if (it == end || *it == ']')
+            throw_parse_exception(is_array ? "Table array name cannot be empty"
+                                           : "Table name cannot be empty");
+
+        auto key_end = [](char c) { return c == ']'; };
+
+        path_.clear();
+        auto key_part_handler = [&](const std::string& part) {
+            if (part.empty())
+                throw_parse_exception(
+                    is_array ? "Empty component of table array name"
+                             : "Empty component of table name");
+            path_.push_back(part);
+        };
+
+        key_part_handler(parse_key(it, end, key_end, key_part_handler));
+
+        auto eat = make_consumer(it, end, [this, is_array]() {
+            throw_parse_exception(
+                is_array
+                    ? "Unterminated table array name"
+                    : "Unterminated table declaration; did you forget a ']'?");
+        });
+        eat(']');
+        if (is_array)
+            eat(']');
+
+        consume_whitespace(it, end);
+        eol_or_comment(it, end);
+
+        if (is_array)
+            handler.table_array_header(path_);
+        else
+            handler.table_header(path_);
+    }
+
+    void stream_key_value(char_iterator& it, char_iterator& end,
+                          event_handler& handler)
+    {
+        auto key_end = [](char c) { return c == '='; };
+
+        path_.clear();
+        auto key_part_handler
+            = [&](const std::string& part) { path_.push_back(part); };
+
+        path_.push_back(parse_key(it, end, key_end, key_part_handler));
+
+        if (it == end || *it != '=')
+            throw_parse_exception("Value must follow after a '='");
+        ++it;
+        consume_whitespace(it, end);
+
+        handler.key(path_);
+        parse_value(it, end)->accept(detail::event_emitter{handler});
+        consume_whitespace(it, end);
+    }
+
+    void parse_key_value(char_iterator& it, char_iterator& end,
                          table* curr_table)
     {
         auto key_end = [](char c) { return c == '='; };
@@ -2156,7 +4093,7 @@ class parser
             }
             else
             {
-                auto newtable = make_table();
+                auto newtable = at_line(make_table());
                 curr_table->insert(part, newtable);
                 curr_table = newtable.get();
             }
@@ -2176,7 +4113,7 @@ class parser
 
     template <class KeyEndFinder, class KeyPartHandler>
     std::string
-    parse_key(std::string::iterator& it, const std::string::iterator& end,
+    parse_key(char_iterator& it, const char_iterator& end,
               KeyEndFinder&& key_end, KeyPartHandler&& key_part_handler)
     {
         // parse the key as a series of one or more simple-keys joined with '.'
@@ -2208,8 +4145,8 @@ class parser
         throw_parse_exception("Unexpected end of key");
     }
 
-    std::string parse_simple_key(std::string::iterator& it,
-                                 const std::string::iterator& end)
+    std::string parse_simple_key(char_iterator& it,
+                                 const char_iterator& end)
     {
         consume_whitespace(it, end);
 
@@ -2229,8 +4166,8 @@ class parser
         }
     }
 
-    std::string parse_bare_key(std::string::iterator& it,
-                               const std::string::iterator& end)
+    std::string parse_bare_key(char_iterator& it,
+                               const char_iterator& end)
     {
         if (it == end)
         {
@@ -2282,9 +4219,25 @@ class parser
         INLINE_TABLE
     };
 
-    std::shared_ptr<base> parse_value(std::string::iterator& it,
-                                      std::string::iterator& end)
+    std::shared_ptr<base> parse_value(char_iterator& it,
+                                      char_iterator& end)
     {
+        // multi-line values are defined on the line they start on
+        auto line = line_number_;
+        auto val = parse_typed_value(it, end);
+        val->line_ = line;
+        return val;
+    }
+
+    std::shared_ptr<base> parse_typed_value(char_iterator& it,
+                                            char_iterator& end)
+    {
+        if (end - it >= 8 && is_number(*it))
+        {
+            if (auto dt = parse_date_fast(it, end))
+                return dt;
+        }
+
         parse_type type = determine_value_type(it, end);
         switch (type)
         {
@@ -2310,8 +4263,8 @@ class parser
         }
     }
 
-    parse_type determine_value_type(const std::string::iterator& it,
-                                    const std::string::iterator& end)
+    parse_type determine_value_type(const char_iterator& it,
+                                    const char_iterator& end)
     {
         if (it == end)
         {
@@ -2352,8 +4305,8 @@ class parser
         throw_parse_exception("Failed to parse value type");
     }
 
-    parse_type determine_number_type(const std::string::iterator& it,
-                                     const std::string::iterator& end)
+    parse_type determine_number_type(const char_iterator& it,
+                                     const char_iterator& end)
     {
         // determine if we are an integer or a float
         auto check_it = it;
@@ -2381,8 +4334,8 @@ class parser
         }
     }
 
-    std::shared_ptr<value<std::string>> parse_string(std::string::iterator& it,
-                                                     std::string::iterator& end)
+    std::shared_ptr<value<std::string>> parse_string(char_iterator& it,
+                                                     char_iterator& end)
     {
         auto delim = *it;
         assert(delim == '"' || delim == '\'');
@@ -2400,22 +4353,54 @@ class parser
                 return parse_multiline_string(it, end, delim);
             }
         }
-        return make_value<std::string>(string_literal(it, end, delim));
+        return string_value(it, end, delim);
     }
 
+    // A single-line string value: the escape sequences are validated here
+    // and the text between the quotes is copied once; decoding is left to
+    // the first access of the value.
     std::shared_ptr<value<std::string>>
-    parse_multiline_string(std::string::iterator& it,
-                           std::string::iterator& end, char delim)
+    string_value(char_iterator& it, const char_iterator& end, char delim)
     {
-        std::stringstream ss;
+        ++it;
+        auto start = it;
+        bool escaped = false;
+        while (it != end)
+        {
+            it = scan_.find_string_special(it, end, delim);
+            if (it == end)
+                break;
+
+            if (delim == '"' && *it == '\\')
+            {
+                escaped = true;
+                parse_escape_code(it, end, nullptr);
+                continue;
+            }
+
+            auto v = make_value(std::string(start, it));
+            if (escaped)
+                v->data_.set_escaped();
+            ++it;
+            consume_whitespace(it, end);
+            return v;
+        }
+        throw_parse_exception("Unterminated string literal");
+    }
+
+    std::shared_ptr<value<std::string>>
+    parse_multiline_string(char_iterator& it,
+                           char_iterator& end, char delim)
+    {
+        std::string ss;
 
         auto is_ws = [](char c) { return c == ' ' || c == '\t'; };
 
         bool consuming = false;
         std::shared_ptr<value<std::string>> ret;
 
-        auto handle_line = [&](std::string::iterator& local_it,
-                               std::string::iterator& local_end) {
+        auto handle_line = [&](char_iterator& local_it,
+                               char_iterator& local_end) {
             if (consuming)
             {
                 local_it = std::find_if_not(local_it, local_end, is_ws);
@@ -2429,6 +4414,14 @@ class parser
 
             while (local_it != local_end)
             {
+                // copy plain content up to the next delimiter or escape
+                auto stop
+                    = scan_.find_string_special(local_it, local_end, delim);
+                ss.append(local_it, stop);
+                local_it = stop;
+                if (local_it == local_end)
+                    break;
+
                 // handle escaped characters
                 if (delim == '"' && *local_it == '\\')
                 {
@@ -2443,7 +4436,7 @@ class parser
                         break;
                     }
 
-                    ss << parse_escape_code(local_it, local_end);
+                    parse_escape_code(local_it, local_end, &ss);
                     continue;
                 }
 
@@ -2456,12 +4449,12 @@ class parser
                         && *check++ == delim)
                     {
                         local_it = check;
-                        ret = make_value<std::string>(ss.str());
+                        ret = make_value(std::move(ss));
                         break;
                     }
                 }
 
-                ss << *local_it++;
+                ss += *local_it++;
             }
         };
 
@@ -2471,53 +4464,55 @@ class parser
             return ret;
 
         // start eating lines
-        while (detail::getline(input_, line_))
+        while (next_line(it, end))
         {
             ++line_number_;
 
-            it = line_.begin();
-            end = line_.end();
-
             handle_line(it, end);
 
             if (ret)
                 return ret;
 
             if (!consuming)
-                ss << std::endl;
+                ss += '\n';
         }
 
         throw_parse_exception("Unterminated multi-line basic string");
     }
 
-    std::string string_literal(std::string::iterator& it,
-                               const std::string::iterator& end, char delim)
+    std::string string_literal(char_iterator& it,
+                               const char_iterator& end, char delim)
     {
         ++it;
         std::string val;
         while (it != end)
         {
+            // copy plain content up to the next delimiter or escape at once
+            auto stop = scan_.find_string_special(it, end, delim);
+            val.append(it, stop);
+            it = stop;
+            if (it == end)
+                break;
+
             // handle escaped characters
             if (delim == '"' && *it == '\\')
             {
-                val += parse_escape_code(it, end);
+                parse_escape_code(it, end, &val);
             }
-            else if (*it == delim)
+            else
             {
                 ++it;
                 consume_whitespace(it, end);
                 return val;
             }
-            else
-            {
-                val += *it++;
-            }
         }
         throw_parse_exception("Unterminated string literal");
     }
 
-    std::string parse_escape_code(std::string::iterator& it,
-                                  const std::string::iterator& end)
+    // Appends the character of the escape sequence at it to out, or only
+    // validates it if out is nullptr.
+    void parse_escape_code(char_iterator& it, const char_iterator& end,
+                           std::string* out)
     {
         ++it;
         if (it == end)
@@ -2553,18 +4548,20 @@ class parser
         }
         else if (*it == 'u' || *it == 'U')
         {
-            return parse_unicode(it, end);
+            parse_unicode(it, end, out);
+            return;
         }
         else
         {
             throw_parse_exception("Invalid escape sequence");
         }
         ++it;
-        return std::string(1, value);
+        if (out)
+            *out += value;
     }
 
-    std::string parse_unicode(std::string::iterator& it,
-                              const std::string::iterator& end)
+    void parse_unicode(char_iterator& it, const char_iterator& end,
+                       std::string* out)
     {
         bool large = *it++ == 'U';
         auto codepoint = parse_hex(it, end, large ? 0x10000000 : 0x1000);
@@ -2575,59 +4572,15 @@ class parser
                 "Unicode escape sequence is not a Unicode scalar value");
         }
 
-        std::string result;
-        // See Table 3-6 of the Unicode standard
-        if (codepoint <= 0x7f)
-        {
-            // 1-byte codepoints: 00000000 0xxxxxxx
-            // repr: 0xxxxxxx
-            result += static_cast<char>(codepoint & 0x7f);
-        }
-        else if (codepoint <= 0x7ff)
-        {
-            // 2-byte codepoints: 00000yyy yyxxxxxx
-            // repr: 110yyyyy 10xxxxxx
-            //
-            // 0x1f = 00011111
-            // 0xc0 = 11000000
-            //
-            result += static_cast<char>(0xc0 | ((codepoint >> 6) & 0x1f));
-            //
-            // 0x80 = 10000000
-            // 0x3f = 00111111
-            //
-            result += static_cast<char>(0x80 | (codepoint & 0x3f));
-        }
-        else if (codepoint <= 0xffff)
-        {
-            // 3-byte codepoints: zzzzyyyy yyxxxxxx
-            // repr: 1110zzzz 10yyyyyy 10xxxxxx
-            //
-            // 0xe0 = 11100000
-            // 0x0f = 00001111
-            //
-            result += static_cast<char>(0xe0 | ((codepoint >> 12) & 0x0f));
-            result += static_cast<char>(0x80 | ((codepoint >> 6) & 0x1f));
-            result += static_cast<char>(0x80 | (codepoint & 0x3f));
-        }
-        else
+        if (out)
         {
-            // 4-byte codepoints: 000uuuuu zzzzyyyy yyxxxxxx
-            // repr: 11110uuu 10uuzzzz 10yyyyyy 10xxxxxx
-            //
-            // 0xf0 = 11110000
-            // 0x07 = 00000111
-            //
-            result += static_cast<char>(0xf0 | ((codepoint >> 18) & 0x07));
-            result += static_cast<char>(0x80 | ((codepoint >> 12) & 0x3f));
-            result += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3f));
-            result += static_cast<char>(0x80 | (codepoint & 0x3f));
+            char buf[4];
+            out->append(buf, detail::encode_utf8(codepoint, buf));
         }
-        return result;
     }
 
-    uint32_t parse_hex(std::string::iterator& it,
-                       const std::string::iterator& end, uint32_t place)
+    uint32_t parse_hex(char_iterator& it,
+                       const char_iterator& end, uint32_t place)
     {
         uint32_t value = 0;
         while (place > 0)
@@ -2653,8 +4606,8 @@ class parser
                                        - ((c >= 'a' && c <= 'f') ? 'a' : 'A'));
     }
 
-    std::shared_ptr<base> parse_number(std::string::iterator& it,
-                                       const std::string::iterator& end)
+    std::shared_ptr<base> parse_number(char_iterator& it,
+                                       const char_iterator& end)
     {
         auto check_it = it;
         auto check_end = find_end_of_number(it, end);
@@ -2708,7 +4661,7 @@ class parser
             {
                 auto start = check_it;
                 eat_numbers();
-                auto val = parse_int(start, check_it, 8, "0");
+                auto val = parse_int(start, check_it, 8);
                 it = start;
                 return val;
             }
@@ -2783,37 +4736,91 @@ class parser
         }
     }
 
-    std::shared_ptr<value<int64_t>> parse_int(std::string::iterator& it,
-                                              const std::string::iterator& end,
-                                              int base = 10,
-                                              const char* prefix = "")
-    {
-        std::string v{it, end};
-        v = prefix + v;
-        v.erase(std::remove(v.begin(), v.end(), '_'), v.end());
-        it = end;
-        try
-        {
-            return make_value<int64_t>(std::stoll(v, nullptr, base));
-        }
-        catch (const std::invalid_argument& ex)
-        {
-            throw_parse_exception("Malformed number (invalid argument: "
-                                  + std::string{ex.what()} + ")");
-        }
-        catch (const std::out_of_range& ex)
+    /**
+     * Converts an integer validated by parse_number() directly from the
+     * input, skipping digit separators in place. A "0x" prefix is allowed
+     * for base 16.
+     */
+    std::shared_ptr<value<int64_t>> parse_int(char_iterator& it,
+                                              const char_iterator& end,
+                                              int base = 10)
+    {
+        bool negative = false;
+        if (it != end && (*it == '-' || *it == '+'))
+            negative = *it++ == '-';
+        if (base == 16 && end - it > 2 && it[0] == '0' && it[1] == 'x')
+            it += 2;
+
+        // magnitude limit: INT64_MAX, or one more for negative numbers
+        const uint64_t limit
+            = static_cast<uint64_t>((std::numeric_limits<int64_t>::max)())
+              + (negative ? 1 : 0);
+
+        uint64_t result = 0;
+        for (; it != end; ++it)
         {
-            throw_parse_exception("Malformed number (out of range: "
-                                  + std::string{ex.what()} + ")");
+            if (*it == '_')
+                continue;
+
+            unsigned digit = hex_to_digit(*it);
+            if (digit >= static_cast<unsigned>(base))
+                throw_parse_exception("Malformed number");
+            if (result > (limit - digit) / base)
+                throw_parse_exception("Malformed number (out of range)");
+            result = result * base + digit;
         }
+
+        if (negative)
+            return make_value<int64_t>(
+                result == limit ? (std::numeric_limits<int64_t>::min)()
+                                : -static_cast<int64_t>(result));
+        return make_value<int64_t>(static_cast<int64_t>(result));
     }
 
-    std::shared_ptr<value<double>> parse_float(std::string::iterator& it,
-                                               const std::string::iterator& end)
+    /**
+     * Converts a float validated by parse_number(). With std::from_chars
+     * the conversion is exact and independent of the C locale; the input
+     * is only copied (to the stack) when it contains digit separators or
+     * a leading '+'.
+     */
+    std::shared_ptr<value<double>> parse_float(char_iterator& it,
+                                               const char_iterator& end)
     {
-        std::string v{it, end};
-        v.erase(std::remove(v.begin(), v.end(), '_'), v.end());
+        char buf[64];
+        std::string heap;
+        const char* first = it;
+        const char* last = end;
         it = end;
+
+        if (*first == '+')
+            ++first;
+
+        if (std::find(first, last, '_') != last)
+        {
+            char* out = buf;
+            if (static_cast<std::size_t>(last - first) > sizeof(buf))
+            {
+                heap.resize(static_cast<std::size_t>(last - first));
+                out = &heap[0];
+            }
+            char* p = out;
+            for (auto c = first; c != last; ++c)
+                if (*c != '_')
+                    *p++ = *c;
+            first = out;
+            last = p;
+        }
+
+#if defined(__cpp_lib_to_chars)
+        double val;
+        auto result = std::from_chars(first, last, val);
+        if (result.ec == std::errc::result_out_of_range)
+            throw_parse_exception("Malformed number (out of range)");
+        if (result.ec != std::errc{} || result.ptr != last)
+            throw_parse_exception("Malformed number");
+        return make_value(val);
+#else
+        std::string v{first, last};
         char decimal_point = std::localeconv()->decimal_point[0];
         std::replace(v.begin(), v.end(), '.', decimal_point);
         try
@@ -2830,10 +4837,11 @@ class parser
             throw_parse_exception("Malformed number (out of range: "
                                   + std::string{ex.what()} + ")");
         }
+#endif
     }
 
-    std::shared_ptr<value<bool>> parse_bool(std::string::iterator& it,
-                                            const std::string::iterator& end)
+    std::shared_ptr<value<bool>> parse_bool(char_iterator& it,
+                                            const char_iterator& end)
     {
         auto eat = make_consumer(it, end, [this]() {
             throw_parse_exception("Attempted to parse invalid boolean value");
@@ -2854,8 +4862,8 @@ class parser
         return nullptr;
     }
 
-    std::string::iterator find_end_of_number(std::string::iterator it,
-                                             std::string::iterator end)
+    char_iterator find_end_of_number(char_iterator it,
+                                             char_iterator end)
     {
         auto ret = std::find_if(it, end, [](char c) {
             return !is_number(c) && c != '_' && c != '.' && c != 'e' && c != 'E'
@@ -2872,8 +4880,8 @@ class parser
         return ret;
     }
 
-    std::string::iterator find_end_of_date(std::string::iterator it,
-                                           std::string::iterator end)
+    char_iterator find_end_of_date(char_iterator it,
+                                           char_iterator end)
     {
         auto end_of_date = std::find_if(it, end, [](char c) {
             return !is_number(c) && c != '-';
@@ -2887,16 +4895,16 @@ class parser
         });
     }
 
-    std::string::iterator find_end_of_time(std::string::iterator it,
-                                           std::string::iterator end)
+    char_iterator find_end_of_time(char_iterator it,
+                                           char_iterator end)
     {
         return std::find_if(it, end, [](char c) {
             return !is_number(c) && c != ':' && c != '.';
         });
     }
 
-    local_time read_time(std::string::iterator& it,
-                         const std::string::iterator& end)
+    local_time read_time(char_iterator& it,
+                         const char_iterator& end)
     {
         auto time_end = find_end_of_time(it, end);
 
@@ -2929,13 +4937,149 @@ class parser
     }
 
     std::shared_ptr<value<local_time>>
-    parse_time(std::string::iterator& it, const std::string::iterator& end)
+    parse_time(char_iterator& it, const char_iterator& end)
     {
         return make_value(read_time(it, end));
     }
 
-    std::shared_ptr<base> parse_date(std::string::iterator& it,
-                                     const std::string::iterator& end)
+    /**
+     * Converts n digits at p, or returns -1 if they are not all digits.
+     */
+    static int fixed_digits(const char* p, int n)
+    {
+        int val = 0;
+        for (int i = 0; i < n; ++i)
+        {
+            auto d = static_cast<unsigned>(p[i] - '0');
+            if (d > 9)
+                return -1;
+            val = 10 * val + static_cast<int>(d);
+        }
+        return val;
+    }
+
+    /**
+     * Reads HH:MM:SS[.fraction] at p into ltime and returns the end of
+     * it, or nullptr if it does not have this layout.
+     */
+    static const char* fixed_time(const char* p, const char* end,
+                                  local_time& ltime)
+    {
+        if (end - p < 8 || p[2] != ':' || p[5] != ':')
+            return nullptr;
+        ltime.hour = fixed_digits(p, 2);
+        ltime.minute = fixed_digits(p + 3, 2);
+        ltime.second = fixed_digits(p + 6, 2);
+        if ((ltime.hour | ltime.minute | ltime.second) < 0)
+            return nullptr;
+        p += 8;
+
+        if (p != end && *p == '.')
+        {
+            ++p;
+            if (p == end || !is_number(*p))
+                return nullptr;
+            int power = 100000;
+            for (; p != end && is_number(*p); ++p)
+            {
+                ltime.microsecond += power * (*p - '0');
+                power /= 10;
+            }
+        }
+        return p;
+    }
+
+    /**
+     * One pass over the fixed RFC 3339 layouts: YYYY-MM-DD, followed by
+     * T (or a space) and HH:MM:SS[.fraction], followed by Z or +HH:MM /
+     * -HH:MM, and bare HH:MM:SS[.fraction]. Returns nullptr without
+     * moving it for anything else, including a layout that is followed
+     * by more date characters, which parse_date() and parse_time() then
+     * handle (and report) as before.
+     */
+    std::shared_ptr<base> parse_date_fast(char_iterator& it,
+                                          const char_iterator& end)
+    {
+        // where find_end_of_date() / find_end_of_time() would go on
+        auto date_char = [](char c) {
+            return is_number(c) || c == 'T' || c == 'Z' || c == ':'
+                   || c == '-' || c == '+' || c == '.';
+        };
+
+        const char* p = it;
+        if (p[2] == ':')
+        {
+            local_time ltime;
+            p = fixed_time(p, end, ltime);
+            if (!p || (p != end && (is_number(*p) || *p == ':' || *p == '.')))
+                return nullptr;
+            it = p;
+            return make_value(ltime);
+        }
+
+        if (end - p < 10 || p[4] != '-' || p[7] != '-')
+            return nullptr;
+
+        local_date ldate;
+        ldate.year = fixed_digits(p, 4);
+        ldate.month = fixed_digits(p + 5, 2);
+        ldate.day = fixed_digits(p + 8, 2);
+        if ((ldate.year | ldate.month | ldate.day) < 0)
+            return nullptr;
+        p += 10;
+
+        bool has_time = p != end
+                        && (*p == 'T'
+                            || (*p == ' ' && p + 1 != end && is_number(p[1])));
+        if (!has_time)
+        {
+            if (p != end && date_char(*p))
+                return nullptr;
+            it = p;
+            return make_value(ldate);
+        }
+
+        local_datetime ldt;
+        static_cast<local_date&>(ldt) = ldate;
+        p = fixed_time(p + 1, end, ldt);
+        if (!p)
+            return nullptr;
+
+        if (p == end || (*p != 'Z' && *p != '+' && *p != '-'))
+        {
+            if (p != end && date_char(*p))
+                return nullptr;
+            it = p;
+            return make_value(ldt);
+        }
+
+        offset_datetime dt;
+        static_cast<local_datetime&>(dt) = ldt;
+        if (*p == 'Z')
+        {
+            ++p;
+        }
+        else
+        {
+            if (end - p < 6 || p[3] != ':')
+                return nullptr;
+            int hoff = fixed_digits(p + 1, 2);
+            int moff = fixed_digits(p + 4, 2);
+            if ((hoff | moff) < 0)
+                return nullptr;
+            dt.hour_offset = *p == '+' ? hoff : -hoff;
+            dt.minute_offset = *p == '+' ? moff : -moff;
+            p += 6;
+        }
+
+        if (p != end && date_char(*p))
+            return nullptr;
+        it = p;
+        return make_value(dt);
+    }
+
+    std::shared_ptr<base> parse_date(char_iterator& it,
+                                     const char_iterator& end)
     {
         auto date_end = find_end_of_date(it, end);
 
@@ -2988,9 +5132,11 @@ class parser
         return make_value(dt);
     }
 
-    std::shared_ptr<base> parse_array(std::string::iterator& it,
-                                      std::string::iterator& end)
+    std::shared_ptr<base> parse_array(char_iterator& it,
+                                      char_iterator& end)
     {
+        depth_guard guard{*this};
+
         // this gets ugly because of the "homogeneity" restriction:
         // arrays can either be of only one type, or contain arrays
         // (each of those arrays could be of different types, though)
@@ -3009,8 +5155,14 @@ class parser
             return make_array();
         }
 
-        auto val_end = std::find_if(
-            it, end, [](char c) { return c == ',' || c == ']' || c == '#'; });
+        // nested arrays, inline tables and strings are told by their first
+        // character; scanning for the end of the value at every level would
+        // make deep nesting quadratic
+        auto val_end = end;
+        if (*it != '[' && *it != '{' && *it != '"' && *it != '\'')
+            val_end = std::find_if(it, end, [](char c) {
+                return c == ',' || c == ']' || c == '#';
+            });
         parse_type type = determine_value_type(it, val_end);
         switch (type)
         {
@@ -3042,8 +5194,8 @@ class parser
     }
 
     template <class Value>
-    std::shared_ptr<array> parse_value_array(std::string::iterator& it,
-                                             std::string::iterator& end)
+    std::shared_ptr<array> parse_value_array(char_iterator& it,
+                                             char_iterator& end)
     {
         auto arr = make_array();
         while (it != end && *it != ']')
@@ -3066,8 +5218,8 @@ class parser
 
     template <class Object, class Function>
     std::shared_ptr<Object> parse_object_array(Function&& fun, char delim,
-                                               std::string::iterator& it,
-                                               std::string::iterator& end)
+                                               char_iterator& it,
+                                               char_iterator& end)
     {
         auto arr = detail::make_element<Object>();
 
@@ -3076,7 +5228,9 @@ class parser
             if (*it != delim)
                 throw_parse_exception("Unexpected character in array");
 
+            auto line = line_number_;
             arr->get().push_back(((*this).*fun)(it, end));
+            arr->get().back()->line_ = line;
             skip_whitespace_and_comments(it, end);
 
             if (it == end || *it != ',')
@@ -3093,9 +5247,11 @@ class parser
         return arr;
     }
 
-    std::shared_ptr<table> parse_inline_table(std::string::iterator& it,
-                                              std::string::iterator& end)
+    std::shared_ptr<table> parse_inline_table(char_iterator& it,
+                                              char_iterator& end)
     {
+        depth_guard guard{*this};
+
         auto tbl = make_table();
         do
         {
@@ -3109,7 +5265,7 @@ class parser
                 parse_key_value(it, end, tbl.get());
                 consume_whitespace(it, end);
             }
-        } while (*it == ',');
+        } while (it != end && *it == ',');
 
         if (it == end || *it != '}')
             throw_parse_exception("Unterminated inline table");
@@ -3120,37 +5276,40 @@ class parser
         return tbl;
     }
 
-    void skip_whitespace_and_comments(std::string::iterator& start,
-                                      std::string::iterator& end)
+    void skip_whitespace_and_comments(char_iterator& start,
+                                      char_iterator& end)
     {
         consume_whitespace(start, end);
         while (start == end || *start == '#')
         {
-            if (!detail::getline(input_, line_))
+            if (!next_line(start, end))
                 throw_parse_exception("Unclosed array");
             line_number_++;
-            start = line_.begin();
-            end = line_.end();
             consume_whitespace(start, end);
         }
     }
 
-    void consume_whitespace(std::string::iterator& it,
-                            const std::string::iterator& end)
+    void consume_whitespace(char_iterator& it,
+                            const char_iterator& end)
     {
-        while (it != end && (*it == ' ' || *it == '\t'))
+        // most runs are zero or one byte long: only go wide past that
+        if (it != end && (*it == ' ' || *it == '\t'))
+        {
             ++it;
+            if (it != end && (*it == ' ' || *it == '\t'))
+                it = scan_.skip_blank(it, end);
+        }
     }
 
-    void consume_backwards_whitespace(std::string::iterator& back,
-                                      const std::string::iterator& front)
+    void consume_backwards_whitespace(char_iterator& back,
+                                      const char_iterator& front)
     {
         while (back != front && (*back == ' ' || *back == '\t'))
             --back;
     }
 
-    void eol_or_comment(const std::string::iterator& it,
-                        const std::string::iterator& end)
+    void eol_or_comment(const char_iterator& it,
+                        const char_iterator& end)
     {
         if (it != end && *it != '#')
             throw_parse_exception("Unidentified trailing character '"
@@ -3158,8 +5317,8 @@ class parser
                                   + "'---did you forget a '#'?");
     }
 
-    bool is_time(const std::string::iterator& it,
-                 const std::string::iterator& end)
+    bool is_time(const char_iterator& it,
+                 const char_iterator& end)
     {
         auto time_end = find_end_of_time(it, end);
         auto len = std::distance(it, time_end);
@@ -3176,8 +5335,8 @@ class parser
         return true;
     }
 
-    option<parse_type> date_type(const std::string::iterator& it,
-                                 const std::string::iterator& end)
+    option<parse_type> date_type(const char_iterator& it,
+                                 const char_iterator& end)
     {
         auto date_end = find_end_of_date(it, end);
         auto len = std::distance(it, date_end);
@@ -3207,17 +5366,157 @@ class parser
         return {};
     }
 
-    std::istream& input_;
-    std::string line_;
+    detail::line_reader reader_;
+    const char* buf_cur_ = nullptr;
+    const char* buf_end_ = nullptr;
+    bool buf_eof_ = false;
     std::size_t line_number_ = 0;
+    std::size_t depth_ = 0;
+    parse_options options_;
+    const detail::scanner& scan_ = options_.scanner
+                                       ? *options_.scanner
+                                       : detail::active_scanner();
+    std::vector<std::string> path_;
 };
 
+/**
+ * Utility function to parse a contiguous, caller-owned buffer as a TOML
+ * document. Returns the root table.
+ */
+inline std::shared_ptr<table> parse_buffer(const char* data, std::size_t size,
+                                           const parse_options& options = {})
+{
+    parser p{data, data + size, options};
+    return p.parse();
+}
+
+/**
+ * Utility function to parse a contiguous, caller-owned buffer as a stream
+ * of events (see event_handler) without building a tree.
+ */
+inline void stream_buffer(const char* data, std::size_t size,
+                          event_handler& handler,
+                          const parse_options& options = {})
+{
+    parser p{data, data + size, options};
+    p.parse(handler);
+}
+
+#if defined(CPPTOML_HAS_MMAP)
+namespace detail
+{
+/**
+ * Read-only private mapping of a whole file. Files that cannot be mapped
+ * (FIFOs, devices, procfs files whose st_size says nothing about their
+ * content) are read through the same descriptor instead, since they
+ * cannot be opened a second time for a stream.
+ */
+class mapped_file
+{
+  public:
+    mapped_file(const std::string& filename)
+    {
+        fd_ = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd_ < 0)
+            return;
+
+        struct stat st;
+        if (::fstat(fd_, &st) != 0)
+        {
+            close();
+            return;
+        }
+
+        if (S_ISREG(st.st_mode) && st.st_size > 0)
+        {
+            size_ = static_cast<std::size_t>(st.st_size);
+            void* addr
+                = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+            if (addr != MAP_FAILED)
+            {
+                data_ = static_cast<const char*>(addr);
+                return;
+            }
+            size_ = 0;
+        }
+
+        if (!read_all())
+            close();
+    }
+
+    ~mapped_file()
+    {
+        if (data_)
+            ::munmap(const_cast<char*>(data_), size_);
+        if (fd_ >= 0)
+            ::close(fd_);
+    }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    bool is_open() const
+    {
+        return fd_ >= 0;
+    }
+
+    const char* data() const
+    {
+        return data_ ? data_ : buf_.data();
+    }
+
+    std::size_t size() const
+    {
+        return data_ ? size_ : buf_.size();
+    }
+
+  private:
+    bool read_all()
+    {
+        char chunk[64 * 1024];
+        for (;;)
+        {
+            auto n = ::read(fd_, chunk, sizeof(chunk));
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            if (n == 0)
+                return true;
+            buf_.append(chunk, static_cast<std::size_t>(n));
+        }
+    }
+
+    void close()
+    {
+        ::close(fd_);
+        fd_ = -1;
+    }
+
+    int fd_ = -1;
+    const char* data_ = nullptr;
+    std::size_t size_ = 0;
+    std::string buf_;
+};
+} // namespace detail
+#endif
+
 /**
  * Utility function to parse a file as a TOML file. Returns the root table.
  * Throws a parse_exception if the file cannot be opened.
  */
-inline std::shared_ptr<table> parse_file(const std::string& filename)
+inline std::shared_ptr<table> parse_file(const std::string& filename,
+                                         const parse_options& options = {})
 {
+#if defined(CPPTOML_HAS_MMAP) && !defined(BOOST_NOWIDE_FSTREAM_INCLUDED_HPP)   \
+    && !defined(NOWIDE_FSTREAM_INCLUDED_HPP)
+    detail::mapped_file file{filename};
+    if (!file.is_open())
+        throw parse_exception{filename + " could not be opened for parsing"};
+    return parse_buffer(file.data(), file.size(), options);
+#else
 #if defined(BOOST_NOWIDE_FSTREAM_INCLUDED_HPP)
     boost::nowide::ifstream file{filename.c_str()};
 #elif defined(NOWIDE_FSTREAM_INCLUDED_HPP)
@@ -3227,8 +5526,38 @@ inline std::shared_ptr<table> parse_file(const std::string& filename)
 #endif
     if (!file.is_open())
         throw parse_exception{filename + " could not be opened for parsing"};
-    parser p{file};
+    parser p{file, options};
     return p.parse();
+#endif
+}
+
+/**
+ * Utility function to parse a file as a stream of events (see
+ * event_handler) without building a tree.
+ * Throws a parse_exception if the file cannot be opened.
+ */
+inline void stream_file(const std::string& filename, event_handler& handler,
+                        const parse_options& options = {})
+{
+#if defined(CPPTOML_HAS_MMAP) && !defined(BOOST_NOWIDE_FSTREAM_INCLUDED_HPP)   \
+    && !defined(NOWIDE_FSTREAM_INCLUDED_HPP)
+    detail::mapped_file file{filename};
+    if (!file.is_open())
+        throw parse_exception{filename + " could not be opened for parsing"};
+    stream_buffer(file.data(), file.size(), handler, options);
+#else
+#if defined(BOOST_NOWIDE_FSTREAM_INCLUDED_HPP)
+    boost::nowide::ifstream file{filename.c_str()};
+#elif defined(NOWIDE_FSTREAM_INCLUDED_HPP)
+    nowide::ifstream file{filename.c_str()};
+#else
+    std::ifstream file{filename};
+#endif
+    if (!file.is_open())
+        throw parse_exception{filename + " could not be opened for parsing"};
+    parser p{file, options};
+    p.parse(handler);
+#endif
 }
 
 template <class... Ts>
@@ -3289,23 +5618,471 @@ void base::accept(Visitor&& visitor, Args&&... args) const
     }
     else if (is_table_array())
     {
-        visitor.visit(static_cast<const table_array&>(*this),
-                      std::forward<Args>(args)...);
+        visitor.visit(static_cast<const table_array&>(*this),
+                      std::forward<Args>(args)...);
+    }
+}
+
+namespace detail
+{
+/**
+ * Heap bytes of a string, 0 while it fits the inline buffer.
+ */
+inline std::size_t string_heap(const std::string& s)
+{
+    static const std::size_t inline_capacity = std::string{}.capacity();
+    return s.capacity() > inline_capacity ? s.capacity() + 1 : 0;
+}
+
+/**
+ * Estimated size of the control block of std::make_shared: the vtable
+ * pointer and the two reference counts.
+ */
+constexpr std::size_t control_block_size = sizeof(void*) + 2 * sizeof(int);
+
+class memory_visitor
+{
+  public:
+    memory_visitor(memory_usage& usage) : usage_(usage)
+    {
+        // nothing
+    }
+
+    void visit(const value<std::string>& v)
+    {
+        const std::string& s = v.get();
+        ++usage_.strings;
+        usage_.string_bytes += s.size();
+        usage_.string_heap_bytes += string_heap(s);
+        node(sizeof(v));
+    }
+
+    void visit(const value<int64_t>& v)
+    {
+        ++usage_.integers;
+        node(sizeof(v));
+    }
+
+    void visit(const value<double>& v)
+    {
+        ++usage_.floats;
+        node(sizeof(v));
+    }
+
+    void visit(const value<bool>& v)
+    {
+        ++usage_.booleans;
+        node(sizeof(v));
+    }
+
+    template <class T>
+    void visit(const value<T>& v)
+    {
+        ++usage_.dates;
+        node(sizeof(v));
+    }
+
+    void visit(const array& a)
+    {
+        ++usage_.arrays;
+        node(sizeof(a));
+        usage_.container_bytes
+            += a.get().capacity() * sizeof(std::shared_ptr<base>);
+        for (const auto& v : a)
+            v->accept(*this);
+    }
+
+    void visit(const table_array& t)
+    {
+        ++usage_.table_arrays;
+        node(sizeof(t));
+        usage_.container_bytes
+            += t.get().capacity() * sizeof(std::shared_ptr<table>);
+        for (const auto& v : t)
+            v->accept(*this);
+    }
+
+    void visit(const table& t)
+    {
+        ++usage_.tables;
+        node(sizeof(t));
+#if defined(CPPTOML_USE_MAP)
+        // a red-black tree node: color and three links
+        usage_.container_bytes
+            += t.map_.size() * (sizeof(string_to_base_map::value_type)
+                                + 4 * sizeof(void*));
+#else
+        usage_.container_bytes += t.map_.memory();
+#endif
+        for (const auto& p : t)
+        {
+            usage_.key_bytes += p.first.size();
+            usage_.string_heap_bytes += string_heap(p.first);
+            p.second->accept(*this);
+        }
+    }
+
+  private:
+    void node(std::size_t size)
+    {
+        usage_.node_bytes += size;
+        usage_.control_block_bytes += control_block_size;
+    }
+
+    memory_usage& usage_;
+};
+} // namespace detail
+
+inline memory_usage base::memory_usage() const
+{
+    cpptoml::memory_usage usage;
+    detail::memory_visitor visitor{usage};
+    accept(visitor);
+    return usage;
+}
+
+/**
+ * A growable contiguous output buffer for toml_buffer_writer. If it is
+ * given a file descriptor, the contents are written out whenever
+ * flush_size bytes have accumulated, and on destruction.
+ */
+class output_buffer
+{
+  public:
+    output_buffer()
+    {
+        // nothing
+    }
+
+#if defined(CPPTOML_HAS_MMAP)
+    explicit output_buffer(int fd, std::size_t flush_size = 64 * 1024)
+        : fd_(fd), flush_size_(flush_size)
+    {
+        buf_.reserve(flush_size);
+    }
+
+    ~output_buffer()
+    {
+        if (fd_ >= 0)
+            flush();
+    }
+#endif
+
+    output_buffer(const output_buffer&) = delete;
+    output_buffer& operator=(const output_buffer&) = delete;
+
+    void append(const char* s, std::size_t n)
+    {
+        buf_.append(s, n);
+        if (fd_ >= 0 && buf_.size() >= flush_size_)
+            flush();
+    }
+
+    void put(char c)
+    {
+        buf_ += c;
+    }
+
+    /**
+     * The contents not yet flushed.
+     */
+    const std::string& str() const
+    {
+        return buf_;
+    }
+
+    const char* data() const
+    {
+        return buf_.data();
+    }
+
+    std::size_t size() const
+    {
+        return buf_.size();
+    }
+
+    void clear()
+    {
+        buf_.clear();
+    }
+
+    /**
+     * Writes the contents to the file descriptor, if any. Returns false
+     * (with errno set) if this or an earlier write failed; the contents
+     * are dropped either way.
+     */
+    bool flush()
+    {
+#if defined(CPPTOML_HAS_MMAP)
+        const char* p = buf_.data();
+        std::size_t left = buf_.size();
+        while (fd_ >= 0 && !failed_ && left > 0)
+        {
+            auto n = ::write(fd_, p, left);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                failed_ = true;
+                break;
+            }
+            p += n;
+            left -= static_cast<std::size_t>(n);
+        }
+        if (fd_ >= 0)
+            buf_.clear();
+#endif
+        return !failed_;
+    }
+
+  private:
+    std::string buf_;
+    int fd_ = -1;
+    std::size_t flush_size_ = 0;
+    bool failed_ = false;
+};
+
+namespace detail
+{
+/**
+ * Output of toml_writer: a std::ostream, formatting as operator<< does.
+ */
+class ostream_output
+{
+  public:
+    ostream_output(std::ostream& stream) : stream_(stream)
+    {
+        // nothing
+    }
+
+    void append(const char* s, std::size_t n)
+    {
+        stream_.write(s, static_cast<std::streamsize>(n));
+    }
+
+    void put(char c)
+    {
+        stream_.put(c);
+    }
+
+    template <class T>
+    void format(const T& v)
+    {
+        stream_ << v;
+    }
+
+    void format(double v)
+    {
+        std::stringstream ss;
+        ss << std::showpoint
+           << std::setprecision(std::numeric_limits<double>::max_digits10)
+           << v;
+
+        auto double_str = ss.str();
+        auto pos = double_str.find("e0");
+        if (pos != std::string::npos)
+            double_str.replace(pos, 2, "e");
+        pos = double_str.find("e-0");
+        if (pos != std::string::npos)
+            double_str.replace(pos, 3, "e-");
+
+        stream_ << double_str;
+    }
+
+  private:
+    std::ostream& stream_;
+};
+
+/**
+ * Output of toml_buffer_writer: an output_buffer, formatting numbers and
+ * dates into a stack buffer and floats in their shortest round-trip form.
+ */
+class buffer_output
+{
+  public:
+    buffer_output(output_buffer& buffer) : buffer_(buffer)
+    {
+        // nothing
+    }
+
+    void append(const char* s, std::size_t n)
+    {
+        buffer_.append(s, n);
+    }
+
+    void put(char c)
+    {
+        buffer_.put(c);
+    }
+
+    void format(int64_t v)
+    {
+        char buf[24];
+        char* end = buf + sizeof(buf);
+        char* p = end;
+        uint64_t u = v < 0 ? 0 - static_cast<uint64_t>(v)
+                           : static_cast<uint64_t>(v);
+        do
+        {
+            *--p = static_cast<char>('0' + u % 10);
+            u /= 10;
+        } while (u);
+        if (v < 0)
+            *--p = '-';
+        append(p, static_cast<std::size_t>(end - p));
+    }
+
+    void format(double v)
+    {
+        char buf[32];
+        std::size_t n;
+#if defined(__cpp_lib_to_chars)
+        n = static_cast<std::size_t>(
+            std::to_chars(buf, buf + sizeof(buf), v).ptr - buf);
+#else
+        // the shortest of %.15g..%.17g that reads back as v
+        for (int prec = 15;; ++prec)
+        {
+            n = static_cast<std::size_t>(
+                std::snprintf(buf, sizeof(buf), "%.*g", prec, v));
+            if (prec == 17 || std::strtod(buf, nullptr) == v
+                || v != v)
+                break;
+        }
+#endif
+        // a float needs a fraction or an exponent to stay a float
+        auto e = static_cast<char*>(std::memchr(buf, 'e', n));
+        if (!e && !std::memchr(buf, '.', n) && !std::memchr(buf, 'n', n))
+        {
+            buf[n++] = '.';
+            buf[n++] = '0';
+        }
+
+        // the parser does not take leading zeros in the exponent ("1e+06")
+        if (e)
+        {
+            char* digits = e + 1;
+            if (*digits == '+' || *digits == '-')
+                ++digits;
+            char* nonzero = digits;
+            while (nonzero + 1 < buf + n && *nonzero == '0')
+                ++nonzero;
+            std::memmove(digits, nonzero,
+                         static_cast<std::size_t>(buf + n - nonzero));
+            n -= static_cast<std::size_t>(nonzero - digits);
+        }
+        append(buf, n);
+    }
+
+    void format(const local_date& dt)
+    {
+        char buf[16];
+        digits(buf, dt.year, 4);
+        buf[4] = '-';
+        digits(buf + 5, dt.month, 2);
+        buf[7] = '-';
+        digits(buf + 8, dt.day, 2);
+        append(buf, 10);
+    }
+
+    void format(const local_time& ltime)
+    {
+        char buf[16];
+        digits(buf, ltime.hour, 2);
+        buf[2] = ':';
+        digits(buf + 3, ltime.minute, 2);
+        buf[5] = ':';
+        digits(buf + 6, ltime.second, 2);
+        std::size_t n = 8;
+
+        // the fraction without trailing zeros
+        if (ltime.microsecond > 0)
+        {
+            buf[n++] = '.';
+            digits(buf + n, ltime.microsecond, 6);
+            n += 6;
+            while (buf[n - 1] == '0')
+                --n;
+        }
+        append(buf, n);
+    }
+
+    void format(const zone_offset& zo)
+    {
+        if (zo.hour_offset == 0 && zo.minute_offset == 0)
+        {
+            put('Z');
+            return;
+        }
+
+        char buf[8];
+        buf[0] = zo.hour_offset > 0 ? '+' : '-';
+        digits(buf + 1, std::abs(zo.hour_offset), 2);
+        buf[3] = ':';
+        digits(buf + 4, std::abs(zo.minute_offset), 2);
+        append(buf, 6);
+    }
+
+    void format(const local_datetime& dt)
+    {
+        format(static_cast<const local_date&>(dt));
+        put('T');
+        format(static_cast<const local_time&>(dt));
+    }
+
+    void format(const offset_datetime& dt)
+    {
+        format(static_cast<const local_datetime&>(dt));
+        format(static_cast<const zone_offset&>(dt));
+    }
+
+    void format(const std::string& str)
+    {
+        append(str.data(), str.size());
+    }
+
+    void format(const char* str)
+    {
+        append(str, std::strlen(str));
+    }
+
+  private:
+    // zero-padded to width; wider values are written in full like setw
+    void digits(char* out, int v, int width)
+    {
+        char buf[12];
+        int n = 0;
+        unsigned u = static_cast<unsigned>(v);
+        do
+        {
+            buf[n++] = static_cast<char>('0' + u % 10);
+            u /= 10;
+        } while (u);
+        for (int i = width; i > n; --i)
+            *out++ = '0';
+        while (n > 0)
+            *out++ = buf[--n];
     }
-}
+
+    output_buffer& buffer_;
+};
+} // namespace detail
 
 /**
  * Writer that can be passed to accept() functions of cpptoml objects and
- * will output valid TOML to a stream.
+ * will output valid TOML. Output is a std::ostream for toml_writer and an
+ * output_buffer for toml_buffer_writer.
  */
-class toml_writer
+template <class Output>
+class basic_toml_writer
 {
   public:
     /**
-     * Construct a toml_writer that will write to the given stream
+     * Construct a writer that will write to the given stream or buffer
      */
-    toml_writer(std::ostream& s, const std::string& indent_space = "\t")
-        : stream_(s), indent_(indent_space), has_naked_endline_(false)
+    template <class Target>
+    basic_toml_writer(Target& target, const std::string& indent_space = "\t")
+        : out_(target), indent_(indent_space), has_naked_endline_(false)
     {
         // nothing
     }
@@ -3326,43 +6103,28 @@ class toml_writer
     void visit(const table& t, bool in_array = false)
     {
         write_table_header(in_array);
-        std::vector<std::string> values;
-        std::vector<std::string> tables;
 
-        for (const auto& i : t)
+        // values first, then the subtables, each in table order
+        bool first = true;
+        for (int pass = 0; pass < 2; ++pass)
         {
-            if (i.second->is_table() || i.second->is_table_array())
+            for (const auto& i : t)
             {
-                tables.push_back(i.first);
-            }
-            else
-            {
-                values.push_back(i.first);
-            }
-        }
-
-        for (unsigned int i = 0; i < values.size(); ++i)
-        {
-            path_.push_back(values[i]);
-
-            if (i > 0)
-                endline();
-
-            write_table_item_header(*t.get(values[i]));
-            t.get(values[i])->accept(*this, false);
-            path_.pop_back();
-        }
+                bool is_table = i.second->is_table()
+                                || i.second->is_table_array();
+                if (is_table != (pass == 1))
+                    continue;
 
-        for (unsigned int i = 0; i < tables.size(); ++i)
-        {
-            path_.push_back(tables[i]);
+                path_.push_back(i.first);
 
-            if (values.size() > 0 || i > 0)
-                endline();
+                if (!first)
+                    endline();
+                first = false;
 
-            write_table_item_header(*t.get(tables[i]));
-            t.get(tables[i])->accept(*this, false);
-            path_.pop_back();
+                write_table_item_header(*i.second);
+                i.second->accept(*this, false);
+                path_.pop_back();
+            }
         }
 
         endline();
@@ -3417,45 +6179,11 @@ class toml_writer
         std::string res;
         for (auto it = str.begin(); it != str.end(); ++it)
         {
-            if (*it == '\b')
-            {
-                res += "\\b";
-            }
-            else if (*it == '\t')
-            {
-                res += "\\t";
-            }
-            else if (*it == '\n')
-            {
-                res += "\\n";
-            }
-            else if (*it == '\f')
-            {
-                res += "\\f";
-            }
-            else if (*it == '\r')
-            {
-                res += "\\r";
-            }
-            else if (*it == '"')
-            {
-                res += "\\\"";
-            }
-            else if (*it == '\\')
-            {
-                res += "\\\\";
-            }
-            else if (static_cast<uint32_t>(*it) <= UINT32_C(0x001f))
-            {
-                res += "\\u";
-                std::stringstream ss;
-                ss << std::hex << static_cast<uint32_t>(*it);
-                res += ss.str();
-            }
+            auto esc = escape_char(*it);
+            if (esc[0])
+                res += esc.data();
             else
-            {
                 res += *it;
-            }
         }
         return res;
     }
@@ -3466,9 +6194,7 @@ class toml_writer
      */
     void write(const value<std::string>& v)
     {
-        write("\"");
-        write(escape_string(v.get()));
-        write("\"");
+        write_quoted(v.get());
     }
 
     /**
@@ -3476,20 +6202,7 @@ class toml_writer
      */
     void write(const value<double>& v)
     {
-        std::stringstream ss;
-        ss << std::showpoint
-           << std::setprecision(std::numeric_limits<double>::max_digits10)
-           << v.get();
-
-        auto double_str = ss.str();
-        auto pos = double_str.find("e0");
-        if (pos != std::string::npos)
-            double_str.replace(pos, 2, "e");
-        pos = double_str.find("e-0");
-        if (pos != std::string::npos)
-            double_str.replace(pos, 3, "e-");
-
-        stream_ << double_str;
+        out_.format(v.get());
         has_naked_endline_ = false;
     }
 
@@ -3537,19 +6250,7 @@ class toml_writer
                     write(".");
                 }
 
-                if (path_[i].find_first_not_of("ABCDEFGHIJKLMNOPQRSTUVWXYZabcde"
-                                               "fghijklmnopqrstuvwxyz0123456789"
-                                               "_-")
-                    == std::string::npos)
-                {
-                    write(path_[i]);
-                }
-                else
-                {
-                    write("\"");
-                    write(escape_string(path_[i]));
-                    write("\"");
-                }
+                write_key(path_[i]);
             }
 
             if (in_array)
@@ -3570,26 +6271,98 @@ class toml_writer
         if (!b.is_table() && !b.is_table_array())
         {
             indent();
-
-            if (path_.back().find_first_not_of("ABCDEFGHIJKLMNOPQRSTUVWXYZabcde"
-                                               "fghijklmnopqrstuvwxyz0123456789"
-                                               "_-")
-                == std::string::npos)
-            {
-                write(path_.back());
-            }
-            else
-            {
-                write("\"");
-                write(escape_string(path_.back()));
-                write("\"");
-            }
-
+            write_key(path_.back());
             write(" = ");
         }
     }
 
   private:
+    /**
+     * The escape sequence of a character, or an empty string if it is
+     * written as is.
+     */
+    static std::array<char, 8> escape_char(char c)
+    {
+        std::array<char, 8> esc{};
+        switch (c)
+        {
+            case '\b':
+                esc[0] = '\\', esc[1] = 'b';
+                break;
+            case '\t':
+                esc[0] = '\\', esc[1] = 't';
+                break;
+            case '\n':
+                esc[0] = '\\', esc[1] = 'n';
+                break;
+            case '\f':
+                esc[0] = '\\', esc[1] = 'f';
+                break;
+            case '\r':
+                esc[0] = '\\', esc[1] = 'r';
+                break;
+            case '"':
+                esc[0] = '\\', esc[1] = '"';
+                break;
+            case '\\':
+                esc[0] = '\\', esc[1] = '\\';
+                break;
+            default:
+                if (static_cast<unsigned char>(c) <= 0x1f)
+                {
+                    const char* hex = "0123456789abcdef";
+                    esc = {{'\\', 'u', '0', '0', hex[(c >> 4) & 0xf],
+                            hex[c & 0xf], 0, 0}};
+                }
+                break;
+        }
+        return esc;
+    }
+
+    /**
+     * Write out a quoted and escaped string, copying the runs between
+     * characters that need escaping at once.
+     */
+    void write_quoted(const std::string& str)
+    {
+        out_.put('"');
+        const char* p = str.data();
+        const char* end = p + str.size();
+        const char* run = p;
+        for (; p != end; ++p)
+        {
+            auto c = static_cast<unsigned char>(*p);
+            if (c > 0x1f && c != '"' && c != '\\')
+                continue;
+
+            out_.append(run, static_cast<std::size_t>(p - run));
+            auto esc = escape_char(*p);
+            out_.append(esc.data(), std::strlen(esc.data()));
+            run = p + 1;
+        }
+        out_.append(run, static_cast<std::size_t>(end - run));
+        out_.put('"');
+        has_naked_endline_ = false;
+    }
+
+    /**
+     * Write out a key, quoted if it is not a bare key.
+     */
+    void write_key(const std::string& key)
+    {
+        if (key.find_first_not_of("ABCDEFGHIJKLMNOPQRSTUVWXYZabcde"
+                                  "fghijklmnopqrstuvwxyz0123456789"
+                                  "_-")
+            == std::string::npos)
+        {
+            write(key);
+        }
+        else
+        {
+            write_quoted(key);
+        }
+    }
+
     /**
      * Indent the proper number of tabs given the size of
      * the path.
@@ -3601,34 +6374,371 @@ class toml_writer
     }
 
     /**
-     * Write a value out to the stream.
+     * Write a value out to the output.
      */
     template <class T>
     void write(const T& v)
     {
-        stream_ << v;
+        out_.format(v);
+        has_naked_endline_ = false;
+    }
+
+    void write(const char* s)
+    {
+        out_.append(s, std::strlen(s));
+        has_naked_endline_ = false;
+    }
+
+    void write(const std::string& s)
+    {
+        out_.append(s.data(), s.size());
         has_naked_endline_ = false;
     }
 
     /**
-     * Write an endline out to the stream
+     * Write an endline out to the output
      */
     void endline()
     {
         if (!has_naked_endline_)
         {
-            stream_ << "\n";
+            out_.put('\n');
             has_naked_endline_ = true;
         }
     }
 
   private:
-    std::ostream& stream_;
+    Output out_;
     const std::string indent_;
     std::vector<std::string> path_;
     bool has_naked_endline_;
 };
 
+/**
+ * Writes TOML to a std::ostream.
+ */
+using toml_writer = basic_toml_writer<detail::ostream_output>;
+
+/**
+ * Writes TOML to an output_buffer (and from there, optionally, to a file
+ * descriptor) without allocating per value. Floats are written in their
+ * shortest round-trip form.
+ *
+ *     cpptoml::output_buffer buf{fd};
+ *     cpptoml::toml_buffer_writer writer{buf};
+ *     root->accept(writer);
+ */
+using toml_buffer_writer = basic_toml_writer<detail::buffer_output>;
+
+/**
+ * Determines if two nodes are structurally equal: same types, same values
+ * (an integer never equals a float), same keys and same array elements.
+ */
+inline bool equal(const base& a, const base& b)
+{
+    if (&a == &b)
+        return true;
+
+    if (a.is_table() || b.is_table())
+    {
+        if (!a.is_table() || !b.is_table())
+            return false;
+
+        auto& ta = static_cast<const table&>(a);
+        auto& tb = static_cast<const table&>(b);
+        if (std::distance(ta.begin(), ta.end())
+            != std::distance(tb.begin(), tb.end()))
+            return false;
+        for (const auto& e : ta)
+        {
+            if (!tb.contains(e.first) || !equal(*e.second, *tb.get(e.first)))
+                return false;
+        }
+        return true;
+    }
+
+    if (a.is_table_array() || b.is_table_array())
+    {
+        if (!a.is_table_array() || !b.is_table_array())
+            return false;
+
+        auto& va = static_cast<const table_array&>(a).get();
+        auto& vb = static_cast<const table_array&>(b).get();
+        if (va.size() != vb.size())
+            return false;
+        for (std::size_t i = 0; i < va.size(); ++i)
+        {
+            if (!equal(*va[i], *vb[i]))
+                return false;
+        }
+        return true;
+    }
+
+    if (a.is_array() || b.is_array())
+    {
+        if (!a.is_array() || !b.is_array())
+            return false;
+
+        auto& va = static_cast<const array&>(a).get();
+        auto& vb = static_cast<const array&>(b).get();
+        if (va.size() != vb.size())
+            return false;
+        for (std::size_t i = 0; i < va.size(); ++i)
+        {
+            if (!equal(*va[i], *vb[i]))
+                return false;
+        }
+        return true;
+    }
+
+    // integers first: as<double>() also accepts integers
+    if (auto x = a.as<int64_t>())
+    {
+        auto y = b.as<int64_t>();
+        return y && x->get() == y->get();
+    }
+    if (b.as<int64_t>())
+        return false;
+    if (auto x = a.as<double>())
+    {
+        auto y = b.as<double>();
+        return y
+               && (x->get() == y->get()
+                   || (x->get() != x->get() && y->get() != y->get()));
+    }
+    if (auto x = a.as<std::string>())
+    {
+        auto y = b.as<std::string>();
+        return y && x->get() == y->get();
+    }
+    if (auto x = a.as<bool>())
+    {
+        auto y = b.as<bool>();
+        return y && x->get() == y->get();
+    }
+    if (auto x = a.as<local_date>())
+    {
+        auto y = b.as<local_date>();
+        return y && x->get() == y->get();
+    }
+    if (auto x = a.as<local_time>())
+    {
+        auto y = b.as<local_time>();
+        return y && x->get() == y->get();
+    }
+    if (auto x = a.as<local_datetime>())
+    {
+        auto y = b.as<local_datetime>();
+        return y && x->get() == y->get();
+    }
+    if (auto x = a.as<offset_datetime>())
+    {
+        auto y = b.as<offset_datetime>();
+        return y && x->get() == y->get();
+    }
+    return false;
+}
+
+/**
+ * One difference between two versions of a document, see diff().
+ */
+struct change
+{
+    enum class kind
+    {
+        added,
+        removed,
+        changed
+    };
+
+    kind type;
+
+    /**
+     * Location of the node, e.g. container[1].screen[0].layer
+     */
+    std::string path;
+
+    std::shared_ptr<base> before; // nullptr if added
+    std::shared_ptr<base> after;  // nullptr if removed
+};
+
+namespace detail
+{
+inline std::string diff_path(const std::string& prefix, const std::string& key)
+{
+    std::string result = prefix;
+    if (!result.empty())
+        result += '.';
+    if (!key.empty()
+        && key.find_first_not_of("ABCDEFGHIJKLMNOPQRSTUVWXYZabcde"
+                                 "fghijklmnopqrstuvwxyz0123456789"
+                                 "_-")
+               == std::string::npos)
+    {
+        result += key;
+    }
+    else
+    {
+        result += '"';
+        result += toml_writer::escape_string(key);
+        result += '"';
+    }
+    return result;
+}
+
+inline void diff_node(const std::shared_ptr<base>& before,
+                      const std::shared_ptr<base>& after,
+                      const std::string& path, std::vector<change>& changes);
+
+inline void diff_table(const table& before, const table& after,
+                       const std::string& prefix, std::vector<change>& changes)
+{
+    for (const auto& e : before)
+    {
+        auto path = diff_path(prefix, e.first);
+        if (after.contains(e.first))
+            diff_node(e.second, after.get(e.first), path, changes);
+        else
+            changes.push_back({change::kind::removed, path, e.second, nullptr});
+    }
+
+    for (const auto& e : after)
+    {
+        if (!before.contains(e.first))
+            changes.push_back({change::kind::added, diff_path(prefix, e.first),
+                               nullptr, e.second});
+    }
+}
+
+inline void diff_node(const std::shared_ptr<base>& before,
+                      const std::shared_ptr<base>& after,
+                      const std::string& path, std::vector<change>& changes)
+{
+    if (before == after || equal(*before, *after))
+        return;
+
+    if (before->is_table() && after->is_table())
+    {
+        diff_table(static_cast<const table&>(*before),
+                   static_cast<const table&>(*after), path, changes);
+        return;
+    }
+
+    // arrays of tables are compared element by element, by position
+    if (before->is_table_array() && after->is_table_array())
+    {
+        auto& vb = before->as_table_array()->get();
+        auto& va = after->as_table_array()->get();
+        for (std::size_t i = 0; i < std::max(vb.size(), va.size()); ++i)
+        {
+            auto elem = path + "[" + std::to_string(i) + "]";
+            if (i >= va.size())
+                changes.push_back({change::kind::removed, elem, vb[i], nullptr});
+            else if (i >= vb.size())
+                changes.push_back({change::kind::added, elem, nullptr, va[i]});
+            else
+                diff_node(vb[i], va[i], elem, changes);
+        }
+        return;
+    }
+
+    changes.push_back({change::kind::changed, path, before, after});
+}
+
+// Returns true if after equals before. Otherwise, replaces the subtrees
+// of after that equal their counterpart in before by that counterpart.
+inline bool share_subtrees(const std::shared_ptr<base>& before,
+                           std::shared_ptr<base>& after)
+{
+    if (before->is_table() && after->is_table())
+    {
+        auto& tb = static_cast<const table&>(*before);
+        auto& ta = static_cast<table&>(*after);
+        bool same = std::distance(tb.begin(), tb.end())
+                    == std::distance(ta.begin(), ta.end());
+        for (auto& e : ta)
+        {
+            if (!tb.contains(e.first))
+            {
+                same = false;
+                continue;
+            }
+
+            auto old = tb.get(e.first);
+            if (share_subtrees(old, e.second))
+                e.second = old;
+            else
+                same = false;
+        }
+        return same;
+    }
+
+    if (before->is_table_array() && after->is_table_array())
+    {
+        auto& vb = before->as_table_array()->get();
+        auto& va = after->as_table_array()->get();
+        bool same = vb.size() == va.size();
+        for (std::size_t i = 0; i < std::min(vb.size(), va.size()); ++i)
+        {
+            std::shared_ptr<base> elem = va[i];
+            if (share_subtrees(vb[i], elem))
+                va[i] = vb[i];
+            else
+                same = false;
+        }
+        return same;
+    }
+
+    return equal(*before, *after);
+}
+} // namespace detail
+
+/**
+ * Lists the differences between two versions of a document: keys that
+ * were added or removed and values that changed, at the deepest table
+ * (or array of tables element) containing them.
+ */
+inline std::vector<change> diff(const table& before, const table& after)
+{
+    std::vector<change> changes;
+    detail::diff_table(before, after, "", changes);
+    return changes;
+}
+
+/**
+ * Replaces the subtrees of next that are equal to their counterpart in
+ * previous by that counterpart, so unchanged parts of a reloaded document
+ * are shared with (and compare pointer-equal to) the previous version.
+ * Shared nodes belong to both trees: modify neither afterwards. They
+ * keep the line() of the previous version.
+ */
+inline void share_unchanged(const std::shared_ptr<table>& previous,
+                            const std::shared_ptr<table>& next)
+{
+    std::shared_ptr<base> root = next;
+    detail::share_subtrees(previous, root);
+}
+
+/**
+ * Parses a new version of a document, reusing the unchanged subtrees of
+ * the previous version (see share_unchanged()). If changes is given, it
+ * receives the diff() between the two versions.
+ */
+inline std::shared_ptr<table> reparse(const std::shared_ptr<table>& previous,
+                                      const char* data, std::size_t size,
+                                      std::vector<change>* changes = nullptr,
+                                      const parse_options& options = {})
+{
+    auto next = parse_buffer(data, size, options);
+    if (previous)
+    {
+        if (changes)
+            *changes = diff(*previous, *next);
+        share_unchanged(previous, next);
+    }
+    return next;
+}
+
 inline std::ostream& operator<<(std::ostream& stream, const base& b)
 {
     toml_writer writer{stream};
@@ -0,0 +1,505 @@
+/*
+ * Copyright (c) 2019,2020 Panasonic Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <unordered_map>
+
+#include "config.hpp"
+#include "signals.hpp"
+#include "toml_schema.hpp"
+
+/*
+ *
+ * Schema of runlxc.conf
+ *
+ */
+static void bind_priority (const std::shared_ptr<cpptoml::base>& b, Priority& out,
+                           const std::string& where)
+{
+  auto v = b->as<std::string>();
+  if (!v) {
+    throw TomlSchemaError(where, "expected string");
+  }
+
+  if (v->get() == "ivi") {
+    out = Priority::IVI;
+  } else if (v->get() == "safety") {
+    out = Priority::SAFETY;
+  } else {
+    throw TomlSchemaError(where, "unknown priority [" + v->get() + "]");
+  }
+}
+
+// ivi_id = <id> or ivi_id = [<min>, <max>]
+static void bind_ivi_id (const std::shared_ptr<cpptoml::base>& b, ScreenConfig& out,
+                         const std::string& where)
+{
+  if (auto id = b->as<int64_t>()) {
+    if (id->get() <= 0 || id->get() > UINT32_MAX) {
+      throw TomlSchemaError(where, "ivi_id out of range");
+    }
+    out.m_ivi_id_min = out.m_ivi_id_max = id->get();
+    return;
+  }
+
+  auto ids = b->as_array();
+  if (!ids) {
+    throw TomlSchemaError(where, "expected integer or [min, max]");
+  }
+
+  auto range = ids->get_array_of<int64_t>();
+  if (!range || range->size() != 2 || (*range)[0] <= 0 ||
+      (*range)[0] > (*range)[1] || (*range)[1] > UINT32_MAX) {
+    throw TomlSchemaError(where, "invalid ivi_id range");
+  }
+  out.m_ivi_id_min = (*range)[0];
+  out.m_ivi_id_max = (*range)[1];
+}
+
+static void check_not_empty (const std::string& value, const std::string& where,
+                             const char *key)
+{
+  if (value.empty()) {
+    throw TomlSchemaError(where.empty() ? key : where + "." + key, "must not be empty");
+  }
+}
+
+static const TomlSchema<ScreenConfig>& screen_schema (void)
+{
+  static const TomlSchema<ScreenConfig> schema = TomlSchema<ScreenConfig>()
+    .required("display", &ScreenConfig::m_display)
+    .required("layer", &ScreenConfig::m_layer_id)
+    .custom("ivi_id", bind_ivi_id)
+    .check([](ScreenConfig& s, const std::string& where) {
+      check_not_empty(s.m_display, where, "display");
+    });
+  return schema;
+}
+
+static const TomlSchema<MirrorConfig>& mirror_schema (void)
+{
+  static const TomlSchema<MirrorConfig> schema = TomlSchema<MirrorConfig>()
+    .required("source", &MirrorConfig::m_source)
+    .required("display", &MirrorConfig::m_display)
+    .required("layer", &MirrorConfig::m_layer_id)
+    .optional("x", &MirrorConfig::m_x)
+    .optional("y", &MirrorConfig::m_y)
+    .required("width", &MirrorConfig::m_width)
+    .required("height", &MirrorConfig::m_height)
+    .optional("opacity", &MirrorConfig::m_opacity)
+    .custom("priority", [](const std::shared_ptr<cpptoml::base>& b, MirrorConfig& m,
+                           const std::string& where) {
+      bind_priority(b, m.m_priority, where);
+    })
+    .check([](MirrorConfig& m, const std::string& where) {
+      check_not_empty(m.m_source, where, "source");
+      check_not_empty(m.m_display, where, "display");
+      if (m.m_layer_id == 0) {
+        throw TomlSchemaError(where + ".layer", "must not be 0");
+      }
+      // the inset is given to ILM as unsigned position and size
+      if (m.m_x < 0 || m.m_y < 0 || m.m_width <= 0 || m.m_height <= 0) {
+        throw TomlSchemaError(where, "inset rectangle must be non-empty and not negative");
+      }
+      if (!(m.m_opacity >= 0.0 && m.m_opacity <= 1.0)) {
+        throw TomlSchemaError(where + ".opacity", "must be within [0.0, 1.0]");
+      }
+    });
+  return schema;
+}
+
+static const TomlSchema<StorageConfig>& storage_schema (void)
+{
+  static const TomlSchema<StorageConfig> schema = TomlSchema<StorageConfig>()
+    .required("src", &StorageConfig::m_src)
+    .required("dst", &StorageConfig::m_dst)
+    .check([](StorageConfig& s, const std::string& where) {
+      check_not_empty(s.m_src, where, "src");
+    });
+  return schema;
+}
+
+static const TomlSchema<ContainerConfig>& container_schema (void)
+{
+  static const TomlSchema<ContainerConfig> schema = TomlSchema<ContainerConfig>()
+    .required("name", &ContainerConfig::m_name)
+    .optional("reboot", &ContainerConfig::m_reboot)
+    .custom("priority", [](const std::shared_ptr<cpptoml::base>& b, ContainerConfig& c,
+                           const std::string& where) {
+      bind_priority(b, c.m_priority, where);
+    })
+    .table_array("screen", &ContainerConfig::m_screens, screen_schema())
+    .table_array("mirror", &ContainerConfig::m_mirrors, mirror_schema())
+    .table_array("storage", &ContainerConfig::m_storages, storage_schema())
+    .check([](ContainerConfig& c, const std::string& where) {
+      check_not_empty(c.m_name, where, "name");
+
+      // a mirror shows one of the screens of its own container
+      for (size_t i = 0; i < c.m_mirrors.size(); i++) {
+        auto& source = c.m_mirrors[i].m_source;
+        auto found = std::find_if(c.m_screens.begin(), c.m_screens.end(),
+                                  [&](const ScreenConfig& s) { return s.m_display == source; });
+        if (found == c.m_screens.end()) {
+          throw TomlSchemaError(where + ".mirror[" + std::to_string(i) + "].source",
+                                "unknown source [" + source + "]");
+        }
+      }
+    });
+  return schema;
+}
+
+static const TomlSchema<RunLXCConfig>& runlxc_schema (void)
+{
+  static const TomlSchema<ILMConfig> ilm = TomlSchema<ILMConfig>()
+    .optional("coalesce", &ILMConfig::m_coalesce);
+
+  // [capture] enables the capture, its keys only tune it
+  static const TomlSchema<CaptureConfig> capture = TomlSchema<CaptureConfig>()
+    .optional("slots", &CaptureConfig::m_slots)
+    .optional("interval", &CaptureConfig::m_interval)
+    .optional("cpu", &CaptureConfig::m_cpu)
+    .check([](CaptureConfig& c, const std::string&) { c.m_enable = true; });
+
+  // containers may also come from fragments, checked after the merge
+  static const TomlSchema<RunLXCConfig> schema = TomlSchema<RunLXCConfig>()
+    .table_array("container", &RunLXCConfig::m_containers, container_schema())
+    .table("ilm", &RunLXCConfig::m_ilm, ilm)
+    .table("capture", &RunLXCConfig::m_capture, capture);
+  return schema;
+}
+
+// runlxc.d/<name>.conf
+static const TomlSchema<RunLXCConfig>& fragment_schema (void)
+{
+  static const TomlSchema<RunLXCConfig> schema = TomlSchema<RunLXCConfig>()
+    .table_array("container", &RunLXCConfig::m_containers, container_schema());
+  return schema;
+}
+
+std::string config_schema_signature (void)
+{
+  return runlxc_schema().signature() + "|" + fragment_schema().signature();
+}
+
+static int parse_source (const char *data, size_t size, const TomlSchema<RunLXCConfig>& schema,
+                         RunLXCConfig& config, std::string& error)
+{
+  try {
+    auto table = cpptoml::parse_buffer(data, size);
+
+    RunLXCConfig result;
+    schema.bind(*table, result);
+    config = std::move(result);
+  } catch (const cpptoml::parse_exception& e) {
+    error = e.what();
+    return -1;
+  } catch (const TomlSchemaError& e) {
+    error = e.what();
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+ *
+ * merge
+ *   containers in source order; container names and ilm layer ids (screens
+ *   and mirrors) must be unique over all sources
+ *
+ */
+struct LayerOwner
+{
+  size_t m_source;
+  std::string m_container;
+};
+
+static int merge_config (const std::vector<std::string>& names, std::vector<RunLXCConfig>& parsed,
+                         RunLXCConfig& config, std::string& error)
+{
+  RunLXCConfig result;
+  std::unordered_map<std::string, size_t> containers;   // name -> source
+  std::unordered_map<unsigned int, LayerOwner> layers;   // layer id -> owner
+
+  auto where = [&](size_t i, const std::string& name) {
+    return (names[i].empty() ? "" : names[i] + ": ") + "container [" + name + "]";
+  };
+
+  auto add_layer = [&](size_t i, const std::string& name, unsigned int id) {
+    auto ret = layers.insert({ id, LayerOwner{ i, name } });
+    if (!ret.second) {
+      auto& owner = ret.first->second;
+      error = where(i, name) + ": layer " + std::to_string(id) + " already used by " +
+              where(owner.m_source, owner.m_container);
+      return false;
+    }
+    return true;
+  };
+
+  for (size_t i = 0; i < parsed.size(); i++) {
+    if (i == 0) {
+      result.m_ilm = parsed[i].m_ilm;
+      result.m_capture = parsed[i].m_capture;
+    }
+
+    for (auto& c : parsed[i].m_containers) {
+      auto ret = containers.insert({ c.m_name, i });
+      if (!ret.second) {
+        error = where(i, c.m_name) + ": already defined" +
+                (names[ret.first->second].empty() ? "" : " in " + names[ret.first->second]);
+        return -1;
+      }
+
+      for (auto& screen : c.m_screens) {
+        if (!add_layer(i, c.m_name, screen.m_layer_id)) {
+          return -1;
+        }
+      }
+      for (auto& mirror : c.m_mirrors) {
+        if (!add_layer(i, c.m_name, mirror.m_layer_id)) {
+          return -1;
+        }
+      }
+
+      result.m_containers.push_back(std::move(c));
+    }
+  }
+
+  if (result.m_containers.empty()) {
+    error = "container: missing required key";
+    return -1;
+  }
+
+  config = std::move(result);
+  return 0;
+}
+
+/*
+ *
+ * parse_config_buffer
+ *   returns 0 and fills config, or -1 and a message with the key path
+ *   (e.g. "container[0].screen[1].layer: expected non-negative integer")
+ *
+ */
+int parse_config_buffer (const char *data, size_t size, RunLXCConfig& config,
+                         std::string& error)
+{
+  std::vector<RunLXCConfig> parsed(1);
+  if (parse_source(data, size, runlxc_schema(), parsed[0], error)) {
+    return -1;
+  }
+
+  return merge_config({ "" }, parsed, config, error);
+}
+
+/*
+ *
+ * read_config_sources
+ *   path (optional if fragments exist), then the *.conf files of fragment_dir
+ *   in lexical order; returns the number of sources, or -1 if none
+ *
+ */
+static int read_file (const char *path, std::string& buf)
+{
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+    close(fd);
+    return -1;
+  }
+
+  // up to EOF, st_size is only a hint (short reads, a file being rewritten)
+  std::string data;
+  data.reserve(st.st_size);
+  char chunk[8192];
+  for (;;) {
+    ssize_t ret = read(fd, chunk, sizeof(chunk));
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      close(fd);
+      return -1;
+    }
+    if (ret == 0) {
+      break;
+    }
+    data.append(chunk, ret);
+  }
+  close(fd);
+
+  buf = std::move(data);
+  return 0;
+}
+
+int read_config_sources (const char *path, const char *fragment_dir,
+                         std::vector<ConfigSource>& sources)
+{
+  sources.clear();
+
+  ConfigSource main;
+  main.m_path = path;
+  if (!read_file(path, main.m_text)) {
+    sources.push_back(std::move(main));
+  }
+
+  std::vector<std::string> names;
+  if (DIR *dir = opendir(fragment_dir)) {
+    while (struct dirent *ent = readdir(dir)) {
+      size_t len = strlen(ent->d_name);
+      if (ent->d_name[0] != '.' && len > 5 && !strcmp(ent->d_name + len - 5, ".conf")) {
+        names.push_back(ent->d_name);
+      }
+    }
+    closedir(dir);
+  }
+  std::sort(names.begin(), names.end());
+
+  for (auto& name : names) {
+    ConfigSource fragment;
+    fragment.m_path = std::string(fragment_dir) + "/" + name;
+    fragment.m_fragment = true;
+    if (read_file(fragment.m_path.c_str(), fragment.m_text)) {
+      continue;                 // removed meanwhile, or not a regular file
+    }
+    sources.push_back(std::move(fragment));
+  }
+
+  return sources.empty() ? -1 : (int)sources.size();
+}
+
+/*
+ *
+ * parse_config_sources
+ *   sources are parsed concurrently on a small pool of threads, then merged
+ *   in their order; the first error (in source order) is reported. Any other
+ *   exception of a worker (e.g. std::bad_alloc) is rethrown on the calling
+ *   thread once all workers are joined.
+ *
+ */
+#define CONFIG_PARSE_THREADS_MAX 4
+
+struct ParseJobs
+{
+  const std::vector<ConfigSource> *m_sources;
+  std::vector<RunLXCConfig> *m_parsed;
+  std::vector<std::string> *m_errors;
+  std::vector<int> *m_results;
+  std::vector<std::exception_ptr> *m_exceptions;
+  std::atomic<size_t> m_next;
+};
+
+static void* parse_worker (void *arg)
+{
+  ParseJobs *jobs = static_cast<ParseJobs*>(arg);
+
+  for (;;) {
+    size_t i = jobs->m_next.fetch_add(1);
+    if (i >= jobs->m_sources->size()) {
+      break;
+    }
+
+    auto& source = (*jobs->m_sources)[i];
+    try {
+      (*jobs->m_results)[i] = parse_source(source.m_text.data(), source.m_text.size(),
+                                           source.m_fragment ? fragment_schema() : runlxc_schema(),
+                                           (*jobs->m_parsed)[i], (*jobs->m_errors)[i]);
+    } catch (...) {
+      // never let it escape a thread (std::terminate)
+      (*jobs->m_exceptions)[i] = std::current_exception();
+    }
+  }
+  return NULL;
+}
+
+int parse_config_sources (const std::vector<ConfigSource>& sources, RunLXCConfig& config,
+                          std::string& error)
+{
+  size_t count = sources.size();
+  std::vector<RunLXCConfig> parsed(count);
+  std::vector<std::string> errors(count);
+  std::vector<int> results(count, -1);
+  std::vector<std::exception_ptr> exceptions(count);
+
+  ParseJobs jobs;
+  jobs.m_sources = &sources;
+  jobs.m_parsed = &parsed;
+  jobs.m_errors = &errors;
+  jobs.m_results = &results;
+  jobs.m_exceptions = &exceptions;
+  jobs.m_next = 0;
+
+  // the calling thread is one of the workers
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t threads = std::min<size_t>(std::min<size_t>(count, CONFIG_PARSE_THREADS_MAX),
+                                    cpus > 0 ? cpus : 1);
+
+  std::vector<pthread_t> workers;
+  {
+    SignalBlock block;
+    for (size_t i = 1; i < threads; i++) {
+      pthread_t thread;
+      if (pthread_create(&thread, NULL, parse_worker, &jobs) != 0) {
+        break;                  // the others take over its share
+      }
+      workers.push_back(thread);
+    }
+  }
+  parse_worker(&jobs);
+  for (auto& thread : workers) {
+    pthread_join(thread, NULL);
+  }
+
+  std::vector<std::string> names;
+  for (size_t i = 0; i < count; i++) {
+    if (exceptions[i]) {
+      std::rethrow_exception(exceptions[i]);
+    }
+    if (results[i]) {
+      error = sources[i].m_path + ": " + errors[i];
+      return -1;
+    }
+    names.push_back(sources[i].m_path);
+  }
+
+  // global settings only come from runlxc.conf
+  if (count > 0 && sources[0].m_fragment) {
+    parsed.insert(parsed.begin(), RunLXCConfig());
+    names.insert(names.begin(), std::string());
+  }
+
+  return merge_config(names, parsed, config, error);
+}
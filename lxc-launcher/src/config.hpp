@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2019,2020 Panasonic Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef RUNLXC_CONFIG_HPP
+#define RUNLXC_CONFIG_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+/*
+ * Resolved configuration of runlxc (runlxc.conf)
+ *
+ * Plain value types without any dependency on ilm/lxc, filled in one pass
+ * from the TOML tree (see config.cpp) or from the binary cache.
+ */
+
+/*
+ * Display priority class of a container
+ *   SAFETY layers are launched/committed first and always pinned on top of
+ *   the render order of their screen.
+ */
+enum class Priority
+{
+  IVI = 0,
+  SAFETY,
+};
+
+/*
+ * [[container.screen]]
+ */
+struct ScreenConfig
+{
+  std::string m_display;        // name of display
+  unsigned int m_layer_id = 0;  // ilm layer id
+
+  // expected ivi surface id(s), 0: any (creation order)
+  unsigned int m_ivi_id_min = 0;
+  unsigned int m_ivi_id_max = 0;
+};
+
+/*
+ * [[container.mirror]]
+ *   inset of a screen of the container on another display
+ *   (picture-in-picture)
+ */
+struct MirrorConfig
+{
+  std::string m_source;         // display of the mirrored screen
+  std::string m_display;        // target display
+  unsigned int m_layer_id = 0;  // ilm layer id of the inset
+  int m_x = 0;
+  int m_y = 0;
+  int m_width = 0;
+  int m_height = 0;
+  double m_opacity = 1.0;
+  Priority m_priority = Priority::IVI;
+};
+
+/*
+ * [[container.storage]]
+ */
+struct StorageConfig
+{
+  std::string m_src;
+  std::string m_dst;
+};
+
+/*
+ * [[container]]
+ */
+struct ContainerConfig
+{
+  std::string m_name;
+  bool m_reboot = false;        // if true, reboot the system when container is stopped
+  Priority m_priority = Priority::IVI;
+
+  std::vector<ScreenConfig> m_screens;
+  std::vector<MirrorConfig> m_mirrors;
+  std::vector<StorageConfig> m_storages;
+};
+
+/*
+ * [capture]
+ */
+struct CaptureConfig
+{
+  bool m_enable = false;
+  unsigned int m_slots = 4;     // number of ring slots
+  unsigned int m_interval = 0;  // periodic capture in msec, 0: on demand only
+  unsigned int m_cpu = 5;       // max CPU usage of capture thread in percent
+};
+
+/*
+ * [ilm]
+ */
+struct ILMConfig
+{
+  unsigned int m_coalesce = 50; // msec, window for ILM notifications
+};
+
+struct RunLXCConfig
+{
+  std::vector<ContainerConfig> m_containers;
+  ILMConfig m_ilm;
+  CaptureConfig m_capture;
+};
+
+/*
+ * comparison, e.g. to find the containers changed by a reload
+ */
+inline bool operator== (const ScreenConfig& a, const ScreenConfig& b)
+{
+  return a.m_display == b.m_display && a.m_layer_id == b.m_layer_id &&
+         a.m_ivi_id_min == b.m_ivi_id_min && a.m_ivi_id_max == b.m_ivi_id_max;
+}
+
+inline bool operator== (const MirrorConfig& a, const MirrorConfig& b)
+{
+  return a.m_source == b.m_source && a.m_display == b.m_display &&
+         a.m_layer_id == b.m_layer_id && a.m_x == b.m_x && a.m_y == b.m_y &&
+         a.m_width == b.m_width && a.m_height == b.m_height &&
+         a.m_opacity == b.m_opacity && a.m_priority == b.m_priority;
+}
+
+inline bool operator== (const StorageConfig& a, const StorageConfig& b)
+{
+  return a.m_src == b.m_src && a.m_dst == b.m_dst;
+}
+
+inline bool operator== (const ContainerConfig& a, const ContainerConfig& b)
+{
+  return a.m_name == b.m_name && a.m_reboot == b.m_reboot && a.m_priority == b.m_priority &&
+         a.m_screens == b.m_screens && a.m_mirrors == b.m_mirrors &&
+         a.m_storages == b.m_storages;
+}
+
+inline bool operator!= (const ContainerConfig& a, const ContainerConfig& b)
+{
+  return !(a == b);
+}
+
+inline bool operator== (const CaptureConfig& a, const CaptureConfig& b)
+{
+  return a.m_enable == b.m_enable && a.m_slots == b.m_slots &&
+         a.m_interval == b.m_interval && a.m_cpu == b.m_cpu;
+}
+
+/*
+ * Source text of runlxc.conf or of a fragment runlxc.d/<name>.conf
+ *   a fragment only contributes [[container]] entries
+ */
+struct ConfigSource
+{
+  std::string m_path;
+  std::string m_text;
+  bool m_fragment = false;
+};
+
+// config.cpp
+int parse_config_buffer (const char *data, size_t size, RunLXCConfig& config,
+                         std::string& error);
+int read_config_sources (const char *path, const char *fragment_dir,
+                         std::vector<ConfigSource>& sources);
+int parse_config_sources (const std::vector<ConfigSource>& sources, RunLXCConfig& config,
+                          std::string& error);
+std::string config_schema_signature (void);
+
+// config_cache.cpp
+uint64_t config_hash (const char *data, size_t size);
+uint64_t config_hash (const std::vector<ConfigSource>& sources);
+int load_config_cache (const char *path, uint64_t source_hash, RunLXCConfig& config);
+int save_config_cache (const char *path, uint64_t source_hash, const RunLXCConfig& config);
+
+// default_config.cpp, generated by runlxc-confgen (config_gen.cpp) when
+// built with RUNLXC_EMBED_DEFAULT_CONFIG
+void default_config (RunLXCConfig& config);
+
+#endif  // RUNLXC_CONFIG_HPP
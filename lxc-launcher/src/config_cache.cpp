@@ -0,0 +1,384 @@
+/*
+ * Copyright (c) 2019,2020 Panasonic Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "runlxc.hpp"
+
+/*
+ *
+ * Binary snapshot of the resolved config
+ *
+ *   header:  magic, version, hash of the schema, hash of the source text,
+ *            size and hash of payload
+ *   payload: global settings and containers, in host byte order
+ *
+ * The snapshot is only a cache: any mismatch (version, schema or source
+ * hash, payload hash, truncated data, out of range values) makes the
+ * caller fall back to the TOML parser. The schema hash covers the keys
+ * and the defaults of this build, which are baked into a resolved config.
+ *
+ */
+#define CONFIG_CACHE_MAGIC   0x474643584c52ULL   /* "RLXCFG" */
+#define CONFIG_CACHE_VERSION 3
+
+struct ConfigCacheHeader
+{
+  uint64_t magic;
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t schema_hash;
+  uint64_t source_hash;
+  uint64_t payload_size;
+  uint64_t payload_hash;
+};
+
+// FNV-1a, 64bit
+static uint64_t fnv1a (uint64_t hash, const char *data, size_t size)
+{
+  for (size_t i = 0; i < size; i++) {
+    hash ^= (unsigned char)data[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+uint64_t config_hash (const char *data, size_t size)
+{
+  return fnv1a(0xcbf29ce484222325ULL, data, size);
+}
+
+// all sources in order, each with its path (a renamed fragment changes the merge order)
+uint64_t config_hash (const std::vector<ConfigSource>& sources)
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (auto& source : sources) {
+    hash = fnv1a(hash, source.m_path.c_str(), source.m_path.size() + 1);
+    uint64_t size = source.m_text.size();
+    hash = fnv1a(hash, reinterpret_cast<const char*>(&size), sizeof(size));
+    hash = fnv1a(hash, source.m_text.data(), source.m_text.size());
+  }
+  return hash;
+}
+
+/*
+ *
+ * CacheWriter / CacheReader
+ *
+ */
+class CacheWriter
+{
+public:
+  void u32 (uint32_t v) { raw(&v, sizeof(v)); }
+  void u64 (uint64_t v) { raw(&v, sizeof(v)); }
+  void f64 (double v) { raw(&v, sizeof(v)); }
+
+  void str (const std::string& s)
+  {
+    u32(s.size());
+    raw(s.data(), s.size());
+  }
+
+  void raw (const void *p, size_t size)
+  {
+    m_buf.append(static_cast<const char*>(p), size);
+  }
+
+  std::string m_buf;
+};
+
+class CacheReader
+{
+public:
+  CacheReader(const char *p, size_t size) : m_p(p), m_end(p + size), m_ok(true) {};
+
+  uint32_t u32 (void) { uint32_t v = 0; raw(&v, sizeof(v)); return v; }
+  uint64_t u64 (void) { uint64_t v = 0; raw(&v, sizeof(v)); return v; }
+  double f64 (void) { double v = 0; raw(&v, sizeof(v)); return v; }
+
+  std::string str (void)
+  {
+    uint32_t size = u32();
+    if (!m_ok || size > (size_t)(m_end - m_p)) {
+      m_ok = false;
+      return std::string();
+    }
+    std::string s(m_p, size);
+    m_p += size;
+    return s;
+  }
+
+  void raw (void *p, size_t size)
+  {
+    if (!m_ok || size > (size_t)(m_end - m_p)) {
+      m_ok = false;
+      return;
+    }
+    memcpy(p, m_p, size);
+    m_p += size;
+  }
+
+  void fail (void) { m_ok = false; }
+  bool ok (void) { return m_ok; }
+  bool done (void) { return m_ok && m_p == m_end; }
+
+private:
+  const char *m_p;
+  const char *m_end;
+  bool m_ok;
+};
+
+/*
+ *
+ * RunLXCConfig
+ *
+ */
+static void save_container (CacheWriter& w, const ContainerConfig& c)
+{
+  w.str(c.m_name);
+  w.u32(c.m_reboot);
+  w.u32((uint32_t)c.m_priority);
+
+  w.u32(c.m_screens.size());
+  for (auto& screen : c.m_screens) {
+    w.str(screen.m_display);
+    w.u32(screen.m_layer_id);
+    w.u32(screen.m_ivi_id_min);
+    w.u32(screen.m_ivi_id_max);
+  }
+
+  w.u32(c.m_mirrors.size());
+  for (auto& mirror : c.m_mirrors) {
+    w.str(mirror.m_source);
+    w.str(mirror.m_display);
+    w.u32(mirror.m_layer_id);
+    w.u32(mirror.m_x);
+    w.u32(mirror.m_y);
+    w.u32(mirror.m_width);
+    w.u32(mirror.m_height);
+    w.f64(mirror.m_opacity);
+    w.u32((uint32_t)mirror.m_priority);
+  }
+
+  w.u32(c.m_storages.size());
+  for (auto& storage : c.m_storages) {
+    w.str(storage.m_src);
+    w.str(storage.m_dst);
+  }
+}
+
+static Priority load_priority (CacheReader& r)
+{
+  uint32_t v = r.u32();
+  if (v > (uint32_t)Priority::SAFETY) {
+    r.fail();
+    return Priority::IVI;
+  }
+  return (Priority)v;
+}
+
+static bool load_container (CacheReader& r, ContainerConfig& c)
+{
+  c.m_name = r.str();
+  c.m_reboot = r.u32();
+  c.m_priority = load_priority(r);
+
+  uint32_t num_screens = r.u32();
+  for (uint32_t i = 0; i < num_screens && r.ok(); i++) {
+    ScreenConfig screen;
+    screen.m_display = r.str();
+    screen.m_layer_id = r.u32();
+    screen.m_ivi_id_min = r.u32();
+    screen.m_ivi_id_max = r.u32();
+    c.m_screens.push_back(screen);
+  }
+
+  uint32_t num_mirrors = r.u32();
+  for (uint32_t i = 0; i < num_mirrors && r.ok(); i++) {
+    MirrorConfig mirror;
+    mirror.m_source = r.str();
+    mirror.m_display = r.str();
+    mirror.m_layer_id = r.u32();
+    mirror.m_x = r.u32();
+    mirror.m_y = r.u32();
+    mirror.m_width = r.u32();
+    mirror.m_height = r.u32();
+    mirror.m_opacity = r.f64();
+    mirror.m_priority = load_priority(r);
+    c.m_mirrors.push_back(mirror);
+  }
+
+  uint32_t num_storages = r.u32();
+  for (uint32_t i = 0; i < num_storages && r.ok(); i++) {
+    StorageConfig storage;
+    storage.m_src = r.str();
+    storage.m_dst = r.str();
+    c.m_storages.push_back(storage);
+  }
+
+  return r.ok();
+}
+
+static void save_config (CacheWriter& w, const RunLXCConfig& config)
+{
+  w.u32(config.m_capture.m_enable);
+  w.u32(config.m_capture.m_slots);
+  w.u32(config.m_capture.m_interval);
+  w.u32(config.m_capture.m_cpu);
+  w.u32(config.m_ilm.m_coalesce);
+
+  w.u32(config.m_containers.size());
+  for (auto& container : config.m_containers) {
+    save_container(w, container);
+  }
+}
+
+// keys of the schema and a config of default values only
+static uint64_t schema_hash (void)
+{
+  static const uint64_t hash = []() {
+    ContainerConfig container;
+    container.m_screens.resize(1);
+    container.m_mirrors.resize(1);
+    container.m_storages.resize(1);
+
+    RunLXCConfig defaults;
+    defaults.m_containers.push_back(container);
+
+    CacheWriter w;
+    w.str(config_schema_signature());
+    save_config(w, defaults);
+    return config_hash(w.m_buf.data(), w.m_buf.size());
+  }();
+  return hash;
+}
+
+int load_config_cache (const char *path, uint64_t source_hash, RunLXCConfig& config)
+{
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(ConfigCacheHeader)) {
+    close(fd);
+    return -1;
+  }
+
+  // single read of the whole snapshot
+  std::string buf(st.st_size, '\0');
+  ssize_t ret = read(fd, &buf[0], buf.size());
+  close(fd);
+  if (ret != (ssize_t)buf.size()) {
+    return -1;
+  }
+
+  ConfigCacheHeader header;
+  memcpy(&header, buf.data(), sizeof(header));
+
+  const char *payload = buf.data() + sizeof(header);
+  size_t payload_size = buf.size() - sizeof(header);
+
+  if (header.magic != CONFIG_CACHE_MAGIC ||
+      header.version != CONFIG_CACHE_VERSION ||
+      header.schema_hash != schema_hash() ||
+      header.source_hash != source_hash ||
+      header.payload_size != payload_size ||
+      header.payload_hash != config_hash(payload, payload_size)) {
+    AGL_DEBUG("config cache [%s] is stale", path);
+    return -1;
+  }
+
+  CacheReader r(payload, payload_size);
+  RunLXCConfig result;
+
+  result.m_capture.m_enable = r.u32();
+  result.m_capture.m_slots = r.u32();
+  result.m_capture.m_interval = r.u32();
+  result.m_capture.m_cpu = r.u32();
+  result.m_ilm.m_coalesce = r.u32();
+
+  uint32_t num_containers = r.u32();
+  for (uint32_t i = 0; i < num_containers && r.ok(); i++) {
+    ContainerConfig container;
+    if (!load_container(r, container)) {
+      break;
+    }
+    result.m_containers.push_back(container);
+  }
+
+  if (!r.done()) {
+    AGL_DEBUG("config cache [%s] is broken", path);
+    return -1;
+  }
+
+  config = std::move(result);
+
+  return 0;
+}
+
+int save_config_cache (const char *path, uint64_t source_hash, const RunLXCConfig& config)
+{
+  CacheWriter w;
+  save_config(w, config);
+
+  ConfigCacheHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = CONFIG_CACHE_MAGIC;
+  header.version = CONFIG_CACHE_VERSION;
+  header.schema_hash = schema_hash();
+  header.source_hash = source_hash;
+  header.payload_size = w.m_buf.size();
+  header.payload_hash = config_hash(w.m_buf.data(), w.m_buf.size());
+
+  // write to a temporary file and rename, so a reader never sees a partial
+  // cache, not even after a power loss
+  std::string dir(path);
+  dir = dir.substr(0, dir.rfind('/'));
+  mkdir(dir.c_str(), 0755);
+
+  std::string tmp = std::string(path) + ".tmp";
+  int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    AGL_DEBUG("cannot create config cache [%s]", tmp.c_str());
+    return -1;
+  }
+
+  bool ok = write(fd, &header, sizeof(header)) == (ssize_t)sizeof(header) &&
+            write(fd, w.m_buf.data(), w.m_buf.size()) == (ssize_t)w.m_buf.size() &&
+            fsync(fd) == 0;
+  close(fd);
+
+  if (!ok || rename(tmp.c_str(), path) < 0) {
+    AGL_DEBUG("cannot write config cache [%s]", path);
+    unlink(tmp.c_str());
+    return -1;
+  }
+
+  int dir_fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd >= 0) {
+    fsync(dir_fd);
+    close(dir_fd);
+  }
+
+  AGL_DEBUG("config cache [%s] updated", path);
+  return 0;
+}
@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2019,2020 Panasonic Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * runlxc-confgen: build time generator of the embedded default config
+ *
+ *   runlxc-confgen <runlxc.conf> <output.cpp>
+ *
+ * Validates runlxc.conf with the same schema as runlxc and writes
+ * default_config(), which fills a RunLXCConfig with the resolved result
+ * directly, so the default needs no parsing at runtime.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "config.hpp"
+
+static std::string quote (const std::string& s)
+{
+  std::string out = "\"";
+  for (unsigned char c : s) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (c < 0x20 || c >= 0x7f) {
+      // always 3 octal digits, so a following digit is not taken in
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\%03o", c);
+      out += buf;
+    } else {
+      out += c;
+    }
+  }
+  return out + "\"";
+}
+
+static const char* priority (Priority p)
+{
+  return p == Priority::SAFETY ? "Priority::SAFETY" : "Priority::IVI";
+}
+
+static void write_container (FILE *fp, const ContainerConfig& c)
+{
+  fprintf(fp, "  {\n"
+              "    ContainerConfig c;\n"
+              "    c.m_name = %s;\n"
+              "    c.m_reboot = %s;\n"
+              "    c.m_priority = %s;\n",
+          quote(c.m_name).c_str(), c.m_reboot ? "true" : "false", priority(c.m_priority));
+
+  for (auto& s : c.m_screens) {
+    fprintf(fp, "    {\n"
+                "      ScreenConfig s;\n"
+                "      s.m_display = %s;\n"
+                "      s.m_layer_id = %uu;\n"
+                "      s.m_ivi_id_min = %uu;\n"
+                "      s.m_ivi_id_max = %uu;\n"
+                "      c.m_screens.push_back(s);\n"
+                "    }\n",
+            quote(s.m_display).c_str(), s.m_layer_id, s.m_ivi_id_min, s.m_ivi_id_max);
+  }
+
+  for (auto& m : c.m_mirrors) {
+    fprintf(fp, "    {\n"
+                "      MirrorConfig m;\n"
+                "      m.m_source = %s;\n"
+                "      m.m_display = %s;\n"
+                "      m.m_layer_id = %uu;\n"
+                "      m.m_x = %d;\n"
+                "      m.m_y = %d;\n"
+                "      m.m_width = %d;\n"
+                "      m.m_height = %d;\n"
+                "      m.m_opacity = %.17g;\n"
+                "      m.m_priority = %s;\n"
+                "      c.m_mirrors.push_back(m);\n"
+                "    }\n",
+            quote(m.m_source).c_str(), quote(m.m_display).c_str(), m.m_layer_id,
+            m.m_x, m.m_y, m.m_width, m.m_height, m.m_opacity, priority(m.m_priority));
+  }
+
+  for (auto& s : c.m_storages) {
+    fprintf(fp, "    {\n"
+                "      StorageConfig s;\n"
+                "      s.m_src = %s;\n"
+                "      s.m_dst = %s;\n"
+                "      c.m_storages.push_back(s);\n"
+                "    }\n",
+            quote(s.m_src).c_str(), quote(s.m_dst).c_str());
+  }
+
+  fprintf(fp, "    config.m_containers.push_back(c);\n"
+              "  }\n");
+}
+
+int main (int argc, char *argv[])
+{
+  if (argc != 3) {
+    fprintf(stderr, "usage: %s <runlxc.conf> <output.cpp>\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  std::ifstream in(argv[1], std::ios::binary);
+  if (!in) {
+    fprintf(stderr, "%s: cannot read %s\n", argv[0], argv[1]);
+    return EXIT_FAILURE;
+  }
+  std::stringstream text;
+  text << in.rdbuf();
+  std::string data = text.str();
+
+  RunLXCConfig config;
+  std::string error;
+  if (parse_config_buffer(data.data(), data.size(), config, error)) {
+    fprintf(stderr, "%s: %s\n", argv[1], error.c_str());
+    return EXIT_FAILURE;
+  }
+
+  // same launch order as RunLXC::load_config()
+  std::stable_partition(config.m_containers.begin(), config.m_containers.end(),
+                        [](const ContainerConfig& c) { return c.m_priority == Priority::SAFETY; });
+
+  FILE *fp = fopen(argv[2], "w");
+  if (!fp) {
+    fprintf(stderr, "%s: cannot write %s\n", argv[0], argv[2]);
+    return EXIT_FAILURE;
+  }
+
+  fprintf(fp, "// generated by runlxc-confgen from %s, do not edit\n"
+              "#include \"config.hpp\"\n"
+              "\n"
+              "void default_config (RunLXCConfig& config)\n"
+              "{\n"
+              "  config = RunLXCConfig();\n"
+              "  config.m_ilm.m_coalesce = %uu;\n"
+              "  config.m_capture.m_enable = %s;\n"
+              "  config.m_capture.m_slots = %uu;\n"
+              "  config.m_capture.m_interval = %uu;\n"
+              "  config.m_capture.m_cpu = %uu;\n",
+          argv[1], config.m_ilm.m_coalesce, config.m_capture.m_enable ? "true" : "false",
+          config.m_capture.m_slots, config.m_capture.m_interval, config.m_capture.m_cpu);
+
+  for (auto& c : config.m_containers) {
+    write_container(fp, c);
+  }
+
+  fprintf(fp, "}\n");
+
+  if (fclose(fp) != 0) {
+    fprintf(stderr, "%s: cannot write %s\n", argv[0], argv[2]);
+    remove(argv[2]);
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
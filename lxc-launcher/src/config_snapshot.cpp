@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2019,2020 Panasonic Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <sched.h>
+
+#include <algorithm>
+
+#include "config_snapshot.hpp"
+
+void ConfigSnapshot::build_index (void)
+{
+  m_index.clear();
+  m_safety_ids.clear();
+  m_safety_ranges.clear();
+
+  for (auto& c : m_config.m_containers) {
+    ContainerIndex index;
+    auto& screens = c.m_screens;
+
+    for (size_t i = 0; i < screens.size(); i++) {
+      auto& s = screens[i];
+      if (s.m_ivi_id_min == 0) {
+        index.m_any.push_back(i);
+      } else if (s.m_ivi_id_min == s.m_ivi_id_max) {
+        index.m_ivi_ids.insert({ s.m_ivi_id_min, i });     // the first screen wins
+      } else {
+        index.m_ranges.push_back(i);
+      }
+
+      if (c.m_priority == Priority::SAFETY && s.m_ivi_id_min != 0) {
+        if (s.m_ivi_id_min == s.m_ivi_id_max) {
+          m_safety_ids.insert(s.m_ivi_id_min);
+        } else {
+          m_safety_ranges.push_back({ s.m_ivi_id_min, s.m_ivi_id_max });
+        }
+      }
+    }
+
+    // insets follow the first screen on their source display
+    index.m_mirrors.resize(screens.size());
+    for (size_t m = 0; m < c.m_mirrors.size(); m++) {
+      auto first = std::find_if(screens.begin(), screens.end(),
+                                [&](const ScreenConfig& s) { return s.m_display == c.m_mirrors[m].m_source; });
+      if (first != screens.end()) {
+        index.m_mirrors[first - screens.begin()].push_back(m);
+      }
+    }
+
+    m_index.push_back(std::move(index));
+  }
+}
+
+ConfigSnapshots::~ConfigSnapshots (void)
+{
+  // no reader may be left at this point
+  for (auto snapshot : m_retired) {
+    delete snapshot;
+  }
+  delete m_current.load();
+}
+
+void ConfigSnapshots::publish (ConfigSnapshot* snapshot)
+{
+  pthread_mutex_lock(&m_mutex);
+
+  snapshot->m_version = ++m_version;
+  const ConfigSnapshot* old = m_current.exchange(snapshot, std::memory_order_seq_cst);
+  if (old) {
+    m_retired.push_back(old);
+  }
+  reclaim_locked();
+
+  pthread_mutex_unlock(&m_mutex);
+}
+
+void ConfigSnapshots::reclaim (void)
+{
+  pthread_mutex_lock(&m_mutex);
+  reclaim_locked();
+  pthread_mutex_unlock(&m_mutex);
+}
+
+void ConfigSnapshots::reclaim_locked (void)
+{
+  if (m_retired.empty()) {
+    return;
+  }
+
+  // a reader still acquiring may have loaded a retired snapshot without
+  // counting itself on it yet; any other reader of it is counted there
+  for (int i = 0; i < 2; i++) {
+    unsigned int phase = m_phase.load(std::memory_order_seq_cst);
+    m_phase.store(phase ^ 1, std::memory_order_seq_cst);
+    while (m_acquiring[phase].load(std::memory_order_seq_cst) != 0) {
+      sched_yield();
+    }
+  }
+
+  auto left = std::remove_if(m_retired.begin(), m_retired.end(),
+                             [](const ConfigSnapshot* snapshot) {
+                               if (snapshot->m_readers.load(std::memory_order_seq_cst) != 0) {
+                                 return false;
+                               }
+                               delete snapshot;
+                               return true;
+                             });
+  m_retired.erase(left, m_retired.end());
+}
@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2019,2020 Panasonic Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef RUNLXC_CONFIG_SNAPSHOT_HPP
+#define RUNLXC_CONFIG_SNAPSHOT_HPP
+
+#include <sys/types.h>
+#include <pthread.h>
+
+#include <atomic>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "config.hpp"
+
+/*
+ * Immutable view of the resolved config and of the running containers
+ *
+ * Published by the main thread whenever a container is (re)launched or the
+ * config is reloaded, and read by the ILM notify threads. A snapshot is
+ * never modified once published.
+ */
+struct ConfigSnapshot
+{
+  uint64_t m_version = 0;       // set by ConfigSnapshots::publish()
+  uint64_t m_hash = 0;          // config_hash() of the sources, 0: built-in
+
+  // ConfigSnapshots::Reader currently holding this snapshot
+  mutable std::atomic<unsigned int> m_readers{0};
+
+  // m_config.m_containers in launch order, m_pids[i] is the init pid of
+  // m_config.m_containers[i], -1 while it is not running
+  RunLXCConfig m_config;
+  std::vector<pid_t> m_pids;
+
+  // screens of a container by surface id, see ILMControl::bind_output()
+  struct ContainerIndex
+  {
+    std::unordered_map<unsigned int, size_t> m_ivi_ids;  // single ivi_id -> screen
+    std::vector<size_t> m_ranges;       // screens with an ivi_id range, in order
+    std::vector<size_t> m_any;          // screens without ivi_id, in order
+    std::vector<std::vector<size_t>> m_mirrors;  // per screen, the mirrors following it
+  };
+  std::vector<ContainerIndex> m_index;  // m_index[i] of m_config.m_containers[i]
+
+  // ivi_ids declared by SAFETY containers
+  std::unordered_set<unsigned int> m_safety_ids;
+  std::vector<std::pair<unsigned int, unsigned int>> m_safety_ranges;
+
+  // fills the indexes from m_config, before publish()
+  void build_index (void);
+
+  const ContainerIndex& index (const ContainerConfig& c) const
+  {
+    return m_index[&c - m_config.m_containers.data()];
+  }
+
+  const ContainerConfig* find_container (pid_t init_pid) const
+  {
+    for (size_t i = 0; i < m_pids.size(); i++) {
+      if (m_pids[i] == init_pid) {
+        return &m_config.m_containers[i];
+      }
+    }
+    return nullptr;
+  }
+
+  // ivi_id (or range) declared by a screen of a SAFETY container
+  bool is_safety_surface (unsigned int ivi_id) const
+  {
+    if (m_safety_ids.count(ivi_id)) {
+      return true;
+    }
+    for (auto& r : m_safety_ranges) {
+      if (r.first <= ivi_id && ivi_id <= r.second) {
+        return true;
+      }
+    }
+    return false;
+  }
+};
+
+/*
+ * RCU-style publication of ConfigSnapshot
+ *
+ * Readers take a Reader for as long as they use the snapshot: a few atomic
+ * operations and no lock. Each snapshot counts its own readers, and
+ * m_acquiring[m_phase] only covers the few instructions between loading
+ * m_current and counting on the snapshot.
+ *
+ * A replaced snapshot is retired and freed by reclaim() once its own
+ * readers have left. reclaim() first waits out the Readers still
+ * acquiring (never those holding a snapshot): it flips m_phase and waits
+ * for the old counter to drain, twice, so that both counters were seen
+ * empty after the swap while new Readers use the other one. The last
+ * reader leaving a retired snapshot reclaims it, so snapshots do not pile
+ * up while other readers keep using the current one.
+ */
+class ConfigSnapshots
+{
+public:
+  ConfigSnapshots(void) {};
+  ~ConfigSnapshots(void);
+
+  ConfigSnapshots(const ConfigSnapshots&) = delete;
+  ConfigSnapshots& operator=(const ConfigSnapshots&) = delete;
+
+  class Reader
+  {
+  public:
+    Reader(ConfigSnapshots& snapshots) : m_snapshots(snapshots)
+    {
+      unsigned int phase = m_snapshots.m_phase.load(std::memory_order_seq_cst);
+      m_snapshots.m_acquiring[phase].fetch_add(1, std::memory_order_seq_cst);
+      m_snapshot = m_snapshots.m_current.load(std::memory_order_seq_cst);
+      if (m_snapshot) {
+        m_snapshot->m_readers.fetch_add(1, std::memory_order_seq_cst);
+      }
+      m_snapshots.m_acquiring[phase].fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+    ~Reader(void)
+    {
+      // the last reader of a retired snapshot (only the pointer is
+      // compared once the count is dropped)
+      if (m_snapshot && m_snapshot->m_readers.fetch_sub(1, std::memory_order_seq_cst) == 1 &&
+          m_snapshots.m_current.load(std::memory_order_seq_cst) != m_snapshot) {
+        m_snapshots.reclaim();
+      }
+    }
+
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+
+    // nullptr until the first publish()
+    const ConfigSnapshot* get(void) const { return m_snapshot; }
+    const ConfigSnapshot* operator-> (void) const { return m_snapshot; }
+
+  private:
+    ConfigSnapshots& m_snapshots;
+    const ConfigSnapshot* m_snapshot;
+  };
+
+  // takes ownership of snapshot
+  void publish (ConfigSnapshot* snapshot);
+  void reclaim (void);
+
+private:
+  std::atomic<const ConfigSnapshot*> m_current{nullptr};
+  std::atomic<unsigned int> m_phase{0};
+  std::atomic<unsigned int> m_acquiring[2] {{0}, {0}};  // Readers between load and count
+
+  // publishers
+  pthread_mutex_t m_mutex = PTHREAD_MUTEX_INITIALIZER;
+  uint64_t m_version = 0;
+  std::vector<const ConfigSnapshot*> m_retired;
+
+  void reclaim_locked (void);
+};
+
+#endif  // RUNLXC_CONFIG_SNAPSHOT_HPP
@@ -0,0 +1,328 @@
+/*
+ * Copyright (c) 2019,2020 Panasonic Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <poll.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+
+#include "runlxc.hpp"
+
+static uint64_t now_nsec (clockid_t clock)
+{
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ *
+ * ILMCapture
+ *   ring buffer of screenshots of managed layers and guest surfaces,
+ *   shared with local clients via memfd
+ *
+ */
+ILMCapture::ILMCapture (const CaptureConfig& config)
+  : m_config(config), m_header(nullptr), m_slots(nullptr), m_seq(0), m_running(false)
+{
+  if (m_config.m_slots == 0) {
+    m_config.m_slots = 1;
+  }
+  if (m_config.m_cpu == 0 || m_config.m_cpu > 100) {
+    m_config.m_cpu = 100;
+  }
+
+  size_t size = sizeof(CaptureHeader) + sizeof(CaptureSlot) * m_config.m_slots;
+
+  m_ctl_fd = memfd_create("runlxc-capture", MFD_CLOEXEC);
+  if (m_ctl_fd < 0 || ftruncate(m_ctl_fd, size) < 0) {
+    AGL_FATAL("ILMCapture: cannot create control memfd (%d)", errno);
+  }
+
+  void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_ctl_fd, 0);
+  if (addr == MAP_FAILED) {
+    AGL_FATAL("ILMCapture: cannot map control memfd (%d)", errno);
+  }
+
+  m_header = static_cast<CaptureHeader*>(addr);
+  m_slots = reinterpret_cast<CaptureSlot*>(static_cast<char*>(addr) + sizeof(CaptureHeader));
+  memset(m_header, 0, size);
+  m_header->magic = CAPTURE_MAGIC;
+  m_header->version = CAPTURE_VERSION;
+  m_header->slot_count = m_config.m_slots;
+
+  for (unsigned int i = 0; i < m_config.m_slots; i++) {
+    char name[32];
+    snprintf(name, sizeof(name), "runlxc-capture-%u", i);
+
+    int fd = memfd_create(name, MFD_CLOEXEC);
+    if (fd < 0) {
+      AGL_FATAL("ILMCapture: cannot create slot memfd (%d)", errno);
+    }
+    m_slot_fds.push_back(fd);
+    m_slot_sizes.push_back(0);
+  }
+
+  m_scratch_fd = memfd_create("runlxc-capture-scratch", MFD_CLOEXEC);
+  if (m_scratch_fd < 0) {
+    AGL_FATAL("ILMCapture: cannot create scratch memfd (%d)", errno);
+  }
+
+  m_event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (m_event_fd < 0) {
+    AGL_FATAL("ILMCapture: cannot create eventfd (%d)", errno);
+  }
+
+  AGL_DEBUG("ILMCapture: slots=%d, interval=%dms, cpu=%d%%",
+            m_config.m_slots, m_config.m_interval, m_config.m_cpu);
+}
+
+ILMCapture::~ILMCapture (void)
+{
+  if (m_running) {
+    m_running = false;
+    request();
+    pthread_join(m_thread, NULL);
+  }
+
+  munmap(m_header, sizeof(CaptureHeader) + sizeof(CaptureSlot) * m_config.m_slots);
+  close(m_ctl_fd);
+  for (auto fd : m_slot_fds) {
+    close(fd);
+  }
+  close(m_scratch_fd);
+  close(m_event_fd);
+}
+
+void ILMCapture::start (void)
+{
+  m_running = true;
+  SignalBlock block;
+  if (pthread_create(&m_thread, NULL, thread_main_static, this) != 0) {
+    AGL_FATAL("ILMCapture: cannot create thread");
+  }
+}
+
+/*
+ * async-signal-safe: only write(2) to the eventfd
+ */
+void ILMCapture::request (void)
+{
+  uint64_t one = 1;
+  ssize_t ret = write(m_event_fd, &one, sizeof(one));
+  (void)ret;
+}
+
+void ILMCapture::add_layer (t_ilm_uint id)
+{
+  pthread_mutex_lock(&m_mutex);
+  if (std::find(m_layers.begin(), m_layers.end(), id) == m_layers.end()) {
+    m_layers.push_back(id);
+  }
+  pthread_mutex_unlock(&m_mutex);
+}
+
+void ILMCapture::remove_layer (t_ilm_uint id)
+{
+  pthread_mutex_lock(&m_mutex);
+  m_layers.erase(std::remove(m_layers.begin(), m_layers.end(), id), m_layers.end());
+  pthread_mutex_unlock(&m_mutex);
+}
+
+void ILMCapture::add_surface (t_ilm_uint id)
+{
+  pthread_mutex_lock(&m_mutex);
+  if (std::find(m_surfaces.begin(), m_surfaces.end(), id) == m_surfaces.end()) {
+    m_surfaces.push_back(id);
+  }
+  pthread_mutex_unlock(&m_mutex);
+}
+
+void ILMCapture::remove_surface (t_ilm_uint id)
+{
+  pthread_mutex_lock(&m_mutex);
+  m_surfaces.erase(std::remove(m_surfaces.begin(), m_surfaces.end(), id), m_surfaces.end());
+  pthread_mutex_unlock(&m_mutex);
+}
+
+static bool copy_image (int from, int to, size_t size)
+{
+  void *addr = mmap(NULL, size, PROT_READ, MAP_SHARED, from, 0);
+  if (addr == MAP_FAILED) {
+    return false;
+  }
+
+  const char *src = static_cast<const char*>(addr);
+  size_t done = 0;
+  while (done < size) {
+    ssize_t n = pwrite(to, src + done, size - done, done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    done += n;
+  }
+
+  munmap(addr, size);
+  return done == size;
+}
+
+bool ILMCapture::capture (ilmObjectType type, t_ilm_uint id)
+{
+  // ilmControl truncates and rewrites the file it is given, which would
+  // fault (SIGBUS) a client mapping the slot, so render into the private
+  // scratch memfd and copy the uncompressed bitmap into the slot
+  char path[sizeof("/proc/self/fd/") + sizeof(int) * 3];
+  sprintf(path, "/proc/self/fd/%d", m_scratch_fd);
+
+  ilmErrorTypes ret;
+  if (type == ILM_LAYER) {
+    ret = ilm_takeLayerScreenshot(path, id);
+  } else {
+    ret = ilm_takeSurfaceScreenshot(path, id);
+  }
+
+  struct stat st;
+  if (ret != ILM_SUCCESS || fstat(m_scratch_fd, &st) < 0 || st.st_size == 0) {
+    AGL_DEBUG("ILMCapture: capture of %s %d failed",
+              type == ILM_LAYER ? "layer" : "surface", id);
+    return false;
+  }
+
+  uint64_t seq = m_seq + 1;
+  unsigned int index = seq % m_config.m_slots;
+  CaptureSlot *slot = &m_slots[index];
+  int fd = m_slot_fds[index];
+
+  // invalidate the slot while it is rewritten
+  __atomic_store_n(&slot->seq, 0, __ATOMIC_RELEASE);
+
+  // a slot only grows, so every page a client has mapped stays valid
+  if ((uint64_t)st.st_size > m_slot_sizes[index]) {
+    if (ftruncate(fd, st.st_size) < 0) {
+      AGL_WARN("ILMCapture: cannot grow slot %u (%d)", index, errno);
+      return false;
+    }
+    m_slot_sizes[index] = st.st_size;
+  }
+
+  if (!copy_image(m_scratch_fd, fd, st.st_size)) {
+    AGL_WARN("ILMCapture: cannot copy into slot %u (%d)", index, errno);
+    return false;
+  }
+
+  slot->type = type;
+  slot->id = id;
+  slot->size = st.st_size;
+  slot->timestamp = now_nsec(CLOCK_MONOTONIC);
+  __atomic_store_n(&slot->seq, seq, __ATOMIC_RELEASE);
+  __atomic_store_n(&m_header->seq, seq, __ATOMIC_RELEASE);
+
+  m_seq = seq;
+  return true;
+}
+
+void* ILMCapture::thread_main_static (void *arg)
+{
+  ILMCapture *c = static_cast<ILMCapture*>(arg);
+  c->thread_main();
+  return NULL;
+}
+
+void ILMCapture::thread_main (void)
+{
+  uint64_t interval = (uint64_t)m_config.m_interval * 1000000;
+  uint64_t periodic = 0;        // deadline of the next periodic capture, 0: none
+  uint64_t next = 0;            // earliest time of next capture (CPU cap)
+
+  if (interval) {
+    periodic = now_nsec(CLOCK_MONOTONIC) + interval;
+  }
+
+  while (m_running) {
+    struct pollfd pfd = { m_event_fd, POLLIN, 0 };
+    int timeout = -1;
+    if (periodic) {
+      uint64_t now = now_nsec(CLOCK_MONOTONIC);
+      timeout = periodic > now ? (int)((periodic - now + 999999) / 1000000) : 0;
+    }
+
+    int ret = poll(&pfd, 1, timeout);
+    if (ret < 0 && errno != EINTR) {
+      AGL_WARN("ILMCapture: poll failed (%d)", errno);
+      break;
+    }
+
+    bool requested = false;
+    if (ret > 0) {
+      uint64_t count;
+      requested = read(m_event_fd, &count, sizeof(count)) == sizeof(count);
+    }
+
+    if (!m_running) {
+      break;
+    }
+
+    // on-demand requests do not shift the periodic schedule; periods
+    // missed while deferred by the CPU cap are skipped, not caught up
+    uint64_t now = now_nsec(CLOCK_MONOTONIC);
+    bool due = periodic && now >= periodic;
+    if (due) {
+      periodic += interval;
+      if (periodic <= now) {
+        periodic = now + interval;
+      }
+    }
+    if (!requested && !due) {
+      continue;
+    }
+
+    // defer (not drop) captures until the CPU budget allows
+    if (now < next) {
+      usleep((next - now) / 1000);
+    }
+
+    std::vector<t_ilm_uint> layers;
+    std::vector<t_ilm_uint> surfaces;
+    pthread_mutex_lock(&m_mutex);
+    layers = m_layers;
+    surfaces = m_surfaces;
+    pthread_mutex_unlock(&m_mutex);
+
+    // a screenshot is a synchronous round trip in which the compositor
+    // renders and writes the image, so the elapsed time (not the CPU time
+    // of this thread) is the cost charged against the budget
+    uint64_t cost = now_nsec(CLOCK_MONOTONIC);
+    for (auto id : layers) {
+      capture(ILM_LAYER, id);
+    }
+    for (auto id : surfaces) {
+      capture(ILM_SURFACE, id);
+    }
+    cost = now_nsec(CLOCK_MONOTONIC) - cost;
+
+    // idle long enough that cost / (cost + idle) <= m_cpu %
+    next = now_nsec(CLOCK_MONOTONIC) + cost * (100 - m_config.m_cpu) / m_config.m_cpu;
+  }
+}
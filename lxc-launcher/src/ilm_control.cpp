@@ -20,10 +20,57 @@
  * SOFTWARE.
  */
 
+#include <time.h>
+
 #include "runlxc.hpp"
 
 static ILMControl *global;
 
+#define PROCPS_BUFSIZE 4096
+
+static uint64_t now_msec (void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * pid: compositor(guest)'s pid, returns its parent (init of the container)
+ */
+static pid_t parent_pid (pid_t pid)
+{
+  char filename[sizeof("/proc//stat") + sizeof (int) * 3];
+  char buf[PROCPS_BUFSIZE];
+
+  sprintf(filename, "/proc/%d/stat", pid);
+
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+
+  int ret = read(fd, buf, PROCPS_BUFSIZE-1);
+  close(fd);
+  buf[ret > 0 ? ret : 0] = '\0';
+
+  char *cp = strrchr(buf, ')');
+
+  if (cp == NULL) {
+    AGL_FATAL("fail to parse PROCPS");
+  }
+
+  char state;
+  pid_t ppid;
+
+  int n = sscanf(cp+2, "%c %u ", &state, &ppid);
+  if (n != 2) {
+    return -1;
+  }
+
+  return ppid;
+}
+
 /*
  *
  * Configure ilm surface
@@ -33,18 +80,43 @@ void ILMControl::configure_ilm_surface(t_ilm_uint id, t_ilm_uint width, t_ilm_ui
 {
   AGL_DEBUG("ILMControl: surface (%d) configured: %d x %d", id, width, height);
 
+  pthread_mutex_lock(&m_output_mutex);
+  auto itr = m_created_surfaces.find(id);
+  if (itr == m_created_surfaces.end()) {
+    pthread_mutex_unlock(&m_output_mutex);
+    AGL_DEBUG("ILMControl: surface (%d) is not managed any more", id);
+    return;
+  }
+  Output output = itr->second;
+  pthread_mutex_unlock(&m_output_mutex);
+
   ilm_surfaceSetDestinationRectangle(id, 0, 0, width, height);
   ilm_surfaceSetSourceRectangle(id, 0, 0, width, height);
   ilm_surfaceSetVisibility(id, ILM_TRUE);
 
-  Output& output = m_created_surfaces[id];
-
   ilm_layerAddSurface(output.m_layer_id, id);
   ilm_surfaceRemoveNotification(id);
 
-  ilm_commitChanges();
-  //pthread_cond_signal(&m_runlxc->m_cond);
+  // insets on other screens, updated in the same commit
+  for (auto& mirror : output.m_mirrors) {
+    AGL_DEBUG("ILMControl: mirror surface (%d) to layer=%d [%s] (%d,%d %dx%d)", id,
+              mirror.m_layer_id, mirror.m_display.c_str(),
+              mirror.m_x, mirror.m_y, mirror.m_width, mirror.m_height);
+
+    ilm_layerSetSourceRectangle(mirror.m_layer_id, 0, 0, width, height);
+    ilm_layerSetDestinationRectangle(mirror.m_layer_id, mirror.m_x, mirror.m_y,
+                                     mirror.m_width, mirror.m_height);
+    ilm_layerSetOpacity(mirror.m_layer_id, mirror.m_opacity);
+    ilm_layerAddSurface(mirror.m_layer_id, id);
+    ilm_layerSetVisibility(mirror.m_layer_id, ILM_TRUE);
+  }
 
+  if (output.m_priority == Priority::SAFETY) {
+    // re-pin safety layers on top in the same commit
+    set_render_order(output.m_name);
+  }
+
+  ilm_commitChanges();
 }
 
 /*
@@ -55,7 +127,18 @@ void ILMControl::configure_ilm_surface(t_ilm_uint id, t_ilm_uint width, t_ilm_ui
 void ILMControl::notify_surface_cb (t_ilm_uint id, struct ilmSurfaceProperties* prop, t_ilm_notification_mask mask)
 {
   if (mask & ILM_NOTIFICATION_CONFIGURED) {
-    configure_ilm_surface(id, prop->origSourceWidth, prop->origSourceHeight);
+    // never delayed by the coalescing window
+    ConfiguredSurface configured = { id, prop->origSourceWidth, prop->origSourceHeight };
+
+    pthread_mutex_lock(&m_notify_mutex);
+    if (is_safety_surface(id)) {
+      m_safety_configured.push_back(configured);
+      pthread_cond_signal(&m_safety_cond);
+    } else {
+      m_configured.push_back(configured);
+      pthread_cond_signal(&m_notify_cond);
+    }
+    pthread_mutex_unlock(&m_notify_mutex);
   }
 }
 
@@ -65,49 +148,260 @@ void ILMControl::notify_surface_cb_static (t_ilm_uint id, struct ilmSurfacePrope
   c->notify_surface_cb(id, prop, mask);
 }
 
-void ILMControl::notify_ilm_cb (ilmObjectType object, t_ilm_uint id, t_ilm_bool created)
+void ILMControl::surface_created (t_ilm_uint surface)
 {
-  if (object == ILM_SURFACE) {
-    struct ilmSurfaceProperties props;
-    t_ilm_uint surface = id;
+  struct ilmSurfaceProperties props;
+
+  ilm_getPropertiesOfSurface(surface, &props);
+  pid_t pid = props.creatorPid;
+
+  // find container in the current snapshot, without blocking a reload
+  ConfigSnapshots::Reader snapshot(m_runlxc->snapshots());
+  pid_t init_pid = parent_pid(pid);
+  const ContainerConfig* c = snapshot.get() ? snapshot->find_container(init_pid) : nullptr;
+  if (c == nullptr || init_pid < 0) {
+    AGL_DEBUG("ILM notify: cannot find container (pid=%d)", pid);
+    return;
+  }
+
+  AGL_DEBUG("ILM notify: container[%s], pid=%d (snapshot %llu)", c->m_name.c_str(), pid,
+            (unsigned long long)snapshot->m_version);
+  AGL_DEBUG("ivi surface (id=%d, pid=%d) is created.", surface, pid);
+
+  // find new guest compositor, bound in one step against the other thread
+  Output output;
+  pthread_mutex_lock(&m_output_mutex);
+  auto created = m_created_surfaces.find(surface);
+  if (created != m_created_surfaces.end()) {
+    // id reused without a destroy seen in between
+    unbind_output(surface, created->second);
+    m_created_surfaces.erase(created);
+  }
+  bool bound = bind_output(*snapshot.get(), *c, init_pid, surface, output);
+  if (bound) {
+    m_created_surfaces[surface] = output;
+  }
+  pthread_mutex_unlock(&m_output_mutex);
 
-    ilm_getPropertiesOfSurface(surface, &props);
-    pid_t pid = props.creatorPid;
+  if (!bound) {
+    AGL_DEBUG("???: no more uninitialized guest output.");
+    return;
+  }
 
-    // find container
-    Container* c = m_runlxc->find_container(pid);
-    if (c == nullptr) {
-      AGL_DEBUG("ILM notify: cannot find container (pid=%d)", pid);
-    } else {
-      AGL_DEBUG("ILM notify: container[%s], pid=%d", c->name(), pid);
+  if (ILMCapture *capture = m_capture.load()) {
+    capture->add_surface(surface);
+  }
 
-      if (!created) {
-        AGL_DEBUG("Compositor of [%s] (id=%d) has been destroyed.", c->name(), surface);
+  pthread_mutex_lock(&m_notify_mutex);
+  if (output.m_priority == Priority::SAFETY) {
+    m_safety_surfaces.insert(surface);
+  } else {
+    m_safety_surfaces.erase(surface);
+  }
+  pthread_mutex_unlock(&m_notify_mutex);
 
-        // clear guest compositor
-        c->clear_output(surface);
-      } else {
-        AGL_DEBUG("ivi surface (id=%d, pid=%d) is created.", surface, pid);
-
-        // find new guest compositor
-        Output* output = c->next_output(surface);
-        if (output == nullptr) {
-          AGL_DEBUG("???: no more uninitialized guest output.");
-        } else {
-          m_created_surfaces[surface] = *output;
-
-          ilm_surfaceAddNotification(surface, notify_surface_cb_static);
-          ilm_commitChanges();
-          ilm_getPropertiesOfSurface(surface, &props);
-
-          if ((props.origSourceWidth != 0) && (props.origSourceHeight != 0)) {
-            // this surface is already configured
-            AGL_DEBUG("surface (id=%d,pid=%d) is already configured", id, pid);
-            configure_ilm_surface(id, props.origSourceWidth, props.origSourceHeight);
-          }
+  ilm_surfaceAddNotification(surface, notify_surface_cb_static);
+  ilm_commitChanges();
+  ilm_getPropertiesOfSurface(surface, &props);
+
+  if ((props.origSourceWidth != 0) && (props.origSourceHeight != 0)) {
+    // this surface is already configured
+    AGL_DEBUG("surface (id=%d,pid=%d) is already configured", surface, pid);
+    configure_ilm_surface(surface, props.origSourceWidth, props.origSourceHeight);
+  }
+}
+
+/*
+ * The surface is gone, its output is free again.
+ * Returns false if the surface was not bound to an output.
+ */
+bool ILMControl::surface_destroyed (t_ilm_uint surface)
+{
+  pthread_mutex_lock(&m_output_mutex);
+  auto itr = m_created_surfaces.find(surface);
+  if (itr == m_created_surfaces.end()) {
+    pthread_mutex_unlock(&m_output_mutex);
+    return false;
+  }
+  Output output = itr->second;
+  m_created_surfaces.erase(itr);
+
+  unbind_output(surface, output);
+  pthread_mutex_unlock(&m_output_mutex);
+
+  AGL_DEBUG("Compositor of [%s] (id=%d) has been destroyed.", output.m_container.c_str(), surface);
+
+  // tear down insets of the source surface
+  if (!output.m_mirrors.empty()) {
+    for (auto& mirror : output.m_mirrors) {
+      ilm_layerRemoveSurface(mirror.m_layer_id, surface);
+      ilm_layerSetVisibility(mirror.m_layer_id, ILM_FALSE);
+    }
+    ilm_commitChanges();
+  }
+
+  if (ILMCapture *capture = m_capture.load()) {
+    capture->remove_surface(surface);
+  }
+  return true;
+}
+
+/*
+ * Output of a container for a new surface, from the index of the snapshot
+ *   1. screen declaring this ivi_id
+ *   2. screen with an ivi_id range containing it, not bound to another surface
+ *   3. first screen without ivi_id not bound to another surface (creation order)
+ * Surfaces bound under an older init pid (container re-launched) do not count.
+ * Called with m_output_mutex held.
+ */
+bool ILMControl::bind_output (const ConfigSnapshot& snapshot, const ContainerConfig& config,
+                              pid_t pid, t_ilm_uint surface, Output& output)
+{
+  const ConfigSnapshot::ContainerIndex& index = snapshot.index(config);
+  auto& screens = config.m_screens;
+
+  auto key = std::make_pair(config.m_name, pid);
+  auto bound = m_bound.find(key);
+  auto is_free = [&](size_t i) {
+    if (bound == m_bound.end() || i >= bound->second.size()) {
+      return true;
+    }
+    return bound->second[i] == 0 || bound->second[i] == surface;
+  };
+
+  size_t found = screens.size();
+
+  auto single = index.m_ivi_ids.find(surface);
+  if (single != index.m_ivi_ids.end()) {
+    found = single->second;
+  }
+
+  for (size_t i = 0; i < index.m_ranges.size() && found == screens.size(); i++) {
+    auto& s = screens[index.m_ranges[i]];
+    if (s.m_ivi_id_min <= surface && surface <= s.m_ivi_id_max && is_free(index.m_ranges[i])) {
+      found = index.m_ranges[i];
+    }
+  }
+
+  for (size_t i = 0; i < index.m_any.size() && found == screens.size(); i++) {
+    if (is_free(index.m_any[i])) {
+      found = index.m_any[i];
+    }
+  }
+
+  if (found == screens.size()) {
+    return false;
+  }
+
+  auto& surfaces = m_bound[key];
+  surfaces.resize(screens.size(), 0);
+  surfaces[found] = surface;
+
+  output = Output(screens[found], config.m_priority);
+  output.m_container = config.m_name;
+  output.m_pid = pid;
+  output.m_screen = found;
+
+  for (auto m : index.m_mirrors[found]) {
+    output.m_mirrors.push_back(config.m_mirrors[m]);
+  }
+
+  return true;
+}
+
+/*
+ * Releases the screen bound by bind_output(). Called with m_output_mutex held.
+ */
+void ILMControl::unbind_output (t_ilm_uint surface, const Output& output)
+{
+  auto bound = m_bound.find(std::make_pair(output.m_container, output.m_pid));
+  if (bound == m_bound.end()) {
+    return;
+  }
+
+  auto& surfaces = bound->second;
+  if (output.m_screen < surfaces.size() && surfaces[output.m_screen] == surface) {
+    surfaces[output.m_screen] = 0;
+  }
+  if (std::count(surfaces.begin(), surfaces.end(), 0) == (ptrdiff_t)surfaces.size()) {
+    m_bound.erase(bound);
+  }
+}
+
+/*
+ * Surface of a SAFETY container: its ivi_id is declared by the config, or
+ * it was bound to a safety output before. Called with m_notify_mutex held.
+ */
+bool ILMControl::is_safety_surface (t_ilm_uint id)
+{
+  if (m_safety_surfaces.count(id)) {
+    return true;
+  }
+  // events of a surface stay in one queue, in order
+  for (auto& e : m_safety_events) {
+    if (e.m_id == id) {
+      return true;
+    }
+  }
+
+  ConfigSnapshots::Reader snapshot(m_runlxc->snapshots());
+  return snapshot.get() && snapshot->is_safety_surface(id);
+}
+
+/*
+ * Surface create/destroy notifications are queued per surface id and acted
+ * on once the coalescing window expires. A crashing and restarting guest
+ * (destroy/create/destroy/create...) then costs at most one destroy and one
+ * create. Safety surfaces go to the safety thread at once instead, so they
+ * neither wait for the window nor queue behind IVI surfaces.
+ */
+void ILMControl::notify_ilm_cb (ilmObjectType object, t_ilm_uint id, t_ilm_bool created)
+{
+  if (object == ILM_SURFACE) {
+    pthread_mutex_lock(&m_notify_mutex);
+
+    m_stats.m_received++;
+
+    if (is_safety_surface(id)) {
+      // take over what is still waiting in the coalescing queue (e.g. the
+      // id became a safety one by a reload)
+      auto itr = m_pending.find(id);
+      if (itr != m_pending.end()) {
+        unsigned int moved = 0;
+        if (itr->second.m_destroyed) {
+          m_safety_events.push_back({ id, false });
+          moved++;
         }
+        if (itr->second.m_created) {
+          m_safety_events.push_back({ id, true });
+          moved++;
+        }
+        m_stats.m_merged += itr->second.m_events - moved;
+        m_pending.erase(itr);
       }
+      m_safety_events.push_back({ id, created == ILM_TRUE });
+
+      pthread_cond_signal(&m_safety_cond);
+      pthread_mutex_unlock(&m_notify_mutex);
+      return;
+    }
+
+    auto itr = m_pending.find(id);
+    if (itr == m_pending.end()) {
+      PendingSurface pending;
+      pending.m_deadline = now_msec() + m_coalesce;
+      itr = m_pending.insert(std::make_pair(id, pending)).first;
     }
+
+    PendingSurface& pending = itr->second;
+    pending.m_events++;
+    if (!created) {
+      pending.m_destroyed = true;
+    }
+    pending.m_created = created;
+
+    pthread_cond_signal(&m_notify_cond);
+    pthread_mutex_unlock(&m_notify_mutex);
   } else if (object == ILM_LAYER) {
     t_ilm_uint layer = id;
     if (created) {
@@ -124,13 +418,168 @@ void ILMControl::notify_ilm_cb_static (ilmObjectType object, t_ilm_uint id, t_il
   c->notify_ilm_cb(object, id, created);
 }
 
+/*
+ *
+ * Notify threads: the coalescing one for IVI surfaces, and one for safety
+ * surfaces which never waits for it
+ *
+ */
+void* ILMControl::notify_thread_static (void *arg)
+{
+  ILMControl *c = static_cast<ILMControl*>(arg);
+  c->notify_thread();
+  return NULL;
+}
+
+void ILMControl::notify_thread (void)
+{
+  pthread_mutex_lock(&m_notify_mutex);
+
+  while (m_notify_running) {
+    if (!m_configured.empty()) {
+      std::vector<ConfiguredSurface> configured;
+      configured.swap(m_configured);
+
+      pthread_mutex_unlock(&m_notify_mutex);
+      for (auto& c : configured) {
+        configure_ilm_surface(c.m_id, c.m_width, c.m_height);
+      }
+      pthread_mutex_lock(&m_notify_mutex);
+      continue;
+    }
+
+    if (m_pending.empty()) {
+      pthread_cond_wait(&m_notify_cond, &m_notify_mutex);
+      continue;
+    }
+
+    uint64_t now = now_msec();
+    uint64_t deadline = UINT64_MAX;
+    for (auto& p : m_pending) {
+      deadline = std::min(deadline, p.second.m_deadline);
+    }
+
+    if (deadline > now) {
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      uint64_t nsec = ts.tv_nsec + (deadline - now) * 1000000;
+      ts.tv_sec += nsec / 1000000000;
+      ts.tv_nsec = nsec % 1000000000;
+      pthread_cond_timedwait(&m_notify_cond, &m_notify_mutex, &ts);
+      continue;
+    }
+
+    // take expired entries
+    std::vector<std::pair<t_ilm_uint, PendingSurface>> expired;
+    for (auto itr = m_pending.begin(); itr != m_pending.end(); ) {
+      if (itr->second.m_deadline <= now) {
+        expired.push_back(*itr);
+        itr = m_pending.erase(itr);
+      } else {
+        ++itr;
+      }
+    }
+    pthread_mutex_unlock(&m_notify_mutex);
+
+    unsigned int events = 0;
+    unsigned int actions = 0;
+    for (auto& p : expired) {
+      t_ilm_uint surface = p.first;
+      PendingSurface& pending = p.second;
+
+      events += pending.m_events;
+
+      if (pending.m_destroyed && surface_destroyed(surface)) {
+        actions++;
+      }
+      if (pending.m_created) {
+        surface_created(surface);
+        actions++;
+      }
+    }
+
+    pthread_mutex_lock(&m_notify_mutex);
+    m_stats.m_processed += actions;
+    m_stats.m_merged += events - actions;
+
+    if (events > actions) {
+      AGL_DEBUG("ILM notify: %d events coalesced into %d (received=%llu, merged=%llu)",
+                events, actions, (unsigned long long)m_stats.m_received,
+                (unsigned long long)m_stats.m_merged);
+    }
+  }
+
+  pthread_mutex_unlock(&m_notify_mutex);
+}
+
+void* ILMControl::safety_thread_static (void *arg)
+{
+  ILMControl *c = static_cast<ILMControl*>(arg);
+  c->safety_thread();
+  return NULL;
+}
+
+void ILMControl::safety_thread (void)
+{
+  pthread_mutex_lock(&m_notify_mutex);
+
+  while (m_notify_running) {
+    if (m_safety_events.empty() && m_safety_configured.empty()) {
+      pthread_cond_wait(&m_safety_cond, &m_notify_mutex);
+      continue;
+    }
+
+    std::vector<SafetyEvent> events;
+    std::vector<ConfiguredSurface> configured;
+    events.swap(m_safety_events);
+    configured.swap(m_safety_configured);
+
+    pthread_mutex_unlock(&m_notify_mutex);
+
+    unsigned int actions = 0;
+    for (auto& e : events) {
+      if (e.m_created) {
+        surface_created(e.m_id);
+        actions++;
+      } else if (surface_destroyed(e.m_id)) {
+        actions++;
+      }
+    }
+    for (auto& c : configured) {
+      configure_ilm_surface(c.m_id, c.m_width, c.m_height);
+    }
+
+    pthread_mutex_lock(&m_notify_mutex);
+    m_stats.m_processed += actions;
+    m_stats.m_merged += events.size() - actions;
+  }
+
+  pthread_mutex_unlock(&m_notify_mutex);
+}
+
+NotifyStats ILMControl::notify_stats (void)
+{
+  pthread_mutex_lock(&m_notify_mutex);
+  NotifyStats stats = m_stats;
+  pthread_mutex_unlock(&m_notify_mutex);
+  return stats;
+}
+
+void ILMControl::set_coalesce (unsigned int msec)
+{
+  pthread_mutex_lock(&m_notify_mutex);
+  m_coalesce = msec;
+  pthread_mutex_unlock(&m_notify_mutex);
+}
+
 /*
  *
  * ILMControl
  *
  */
 ILMControl::ILMControl(RunLXC *runlxc) 
-  : m_runlxc(runlxc), m_cb_registered(false)
+  : m_runlxc(runlxc), m_cb_registered(false), m_capture(nullptr),
+    m_coalesce(0), m_notify_running(true)
 {
   // dirty hack: wait for weston readiness
   while (1) {
@@ -141,6 +590,10 @@ ILMControl::ILMControl(RunLXC *runlxc)
   }
 
   AGL_DEBUG("ILMControl:start");
+
+  // threads of ilmControl and the notify threads never take our signals
+  SignalBlock block;
+
   ilm_init();
 
   t_ilm_uint* screen_ids = NULL;
@@ -172,31 +625,173 @@ ILMControl::ILMControl(RunLXC *runlxc)
 
   global = this;
 
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&m_notify_cond, &attr);
+  pthread_condattr_destroy(&attr);
+  pthread_cond_init(&m_safety_cond, NULL);
+
+  if (pthread_create(&m_notify_thread, NULL, notify_thread_static, this) != 0) {
+    AGL_FATAL("ILMControl: cannot create notify thread");
+  }
+  if (pthread_create(&m_safety_thread, NULL, safety_thread_static, this) != 0) {
+    AGL_FATAL("ILMControl: cannot create safety thread");
+  }
+
   AGL_DEBUG("ILMControl:end");
 }
 
-void ILMControl::create_layer (const std::string& display, t_ilm_uint id)
+/*
+ * Render order of the screen: layers in creation order, but every SAFETY
+ * layer is placed above all IVI layers (the last one is the top most).
+ */
+void ILMControl::set_render_order (const std::string& display)
 {
-  ILMScreen screen = m_screens[display];
+  pthread_mutex_lock(&m_output_mutex);
+
+  auto found = m_screens.find(display);
+  if (found == m_screens.end()) {
+    pthread_mutex_unlock(&m_output_mutex);
+    AGL_WARN("ILMControl: unknown display [%s]", display.c_str());
+    return;
+  }
+  ILMScreen& screen = found->second;
+
+  std::vector<t_ilm_layer> render_order;
+
+  for (auto& layer : screen.m_layers) {
+    if (layer.second != Priority::SAFETY) {
+      render_order.push_back(layer.first);
+    }
+  }
+  for (auto& layer : screen.m_layers) {
+    if (layer.second == Priority::SAFETY) {
+      render_order.push_back(layer.first);
+    }
+  }
+
+  // set in the same critical section, so a concurrent update cannot
+  // overwrite a newer order with an older one
+  ilm_displaySetRenderOrder(screen.m_id, render_order.data(), render_order.size());
+
+  pthread_mutex_unlock(&m_output_mutex);
+}
 
-  t_ilm_layer render_order[1] = { id };
+void ILMControl::create_layer (const std::string& display, t_ilm_uint id, Priority priority)
+{
+  pthread_mutex_lock(&m_output_mutex);
+  auto found = m_screens.find(display);
+  if (found == m_screens.end()) {
+    pthread_mutex_unlock(&m_output_mutex);
+    AGL_WARN("ILMControl: layer=%d not created, unknown display [%s]", id, display.c_str());
+    return;
+  }
+  t_ilm_uint screen_id = found->second.m_id;
+  t_ilm_uint width = found->second.m_width;
+  t_ilm_uint height = found->second.m_height;
+  pthread_mutex_unlock(&m_output_mutex);
 
-  AGL_DEBUG("ILMControl: create layer=%d to screen=%d,[%s]", id, screen.m_id, display.c_str());
+  AGL_DEBUG("ILMControl: create layer=%d to screen=%d,[%s]%s", id, screen_id, display.c_str(),
+            priority == Priority::SAFETY ? " (safety)" : "");
 
-  ilm_layerCreateWithDimension(&id, screen.m_width, screen.m_height);
+  ilm_layerCreateWithDimension(&id, width, height);
   ilm_layerSetVisibility(id, ILM_TRUE);
-  ilm_displaySetRenderOrder(screen.m_id, render_order, 1);
+
+  // listed only once it exists, the notify threads may set the order any time
+  pthread_mutex_lock(&m_output_mutex);
+  auto& layers = m_screens[display].m_layers;
+  auto itr = std::find_if(layers.begin(), layers.end(),
+                          [id](const std::pair<t_ilm_layer, Priority>& l) { return l.first == id; });
+  if (itr == layers.end()) {
+    layers.push_back(std::make_pair(id, priority));
+  }
+  pthread_mutex_unlock(&m_output_mutex);
+
+  set_render_order(display);
   ilm_commitChanges();
 
   if (!m_cb_registered) {
     ilm_registerNotification(notify_ilm_cb_static, this);
     m_cb_registered = true;
   }
+
+  if (ILMCapture *capture = m_capture.load()) {
+    capture->add_layer(id);
+  }
+}
+
+void ILMControl::remove_layer (const std::string& display, t_ilm_uint id)
+{
+  pthread_mutex_lock(&m_output_mutex);
+  auto found = m_screens.find(display);
+  if (found == m_screens.end()) {
+    pthread_mutex_unlock(&m_output_mutex);
+    AGL_WARN("ILMControl: layer=%d not removed, unknown display [%s]", id, display.c_str());
+    return;
+  }
+  ILMScreen& screen = found->second;
+
+  AGL_DEBUG("ILMControl: remove layer=%d from screen=%d,[%s]", id, screen.m_id, display.c_str());
+
+  auto itr = std::find_if(screen.m_layers.begin(), screen.m_layers.end(),
+                          [id](const std::pair<t_ilm_layer, Priority>& l) { return l.first == id; });
+  if (itr != screen.m_layers.end()) {
+    screen.m_layers.erase(itr);
+  }
+  pthread_mutex_unlock(&m_output_mutex);
+
+  if (ILMCapture *capture = m_capture.load()) {
+    capture->remove_layer(id);
+  }
+
+  ilm_layerRemove(id);
+  set_render_order(display);
+  ilm_commitChanges();
+}
+
+void ILMControl::start_capture (const CaptureConfig& config)
+{
+  if (m_capture.load()) {
+    return;
+  }
+
+  ILMCapture *capture = new ILMCapture(config);
+  capture->start();
+  m_capture.store(capture);
+}
+
+void ILMControl::request_capture (void)
+{
+  if (ILMCapture *capture = m_capture.load()) {
+    capture->request();
+  }
+}
+
+void ILMControl::request_capture_static (void)
+{
+  if (global) {
+    global->request_capture();
+  }
 }
 
 ILMControl::~ILMControl(void) {
-  m_screens.clear();
   ilm_unregisterNotification();
+
+  // the notify threads add and remove surfaces of the capture
+  pthread_mutex_lock(&m_notify_mutex);
+  m_notify_running = false;
+  pthread_cond_signal(&m_notify_cond);
+  pthread_cond_signal(&m_safety_cond);
+  pthread_mutex_unlock(&m_notify_mutex);
+  pthread_join(m_notify_thread, NULL);
+  pthread_join(m_safety_thread, NULL);
+  pthread_cond_destroy(&m_notify_cond);
+  pthread_cond_destroy(&m_safety_cond);
+
+  delete m_capture.load();
+  m_screens.clear();
+
   ilm_destroy();
   AGL_DEBUG("ilm_destory().\n");
 }
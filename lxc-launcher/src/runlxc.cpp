@@ -19,12 +19,15 @@
  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
  * SOFTWARE.
  */
-#include "cpptoml/cpptoml.h"
+#include <errno.h>
+#include <poll.h>
 
 #include "runlxc.hpp"
 
 #define RUNLXC_CONFIG_PATH "/etc/lxc"
 #define RUNLXC_CONFIG "runlxc.conf"
+#define RUNLXC_CONFIG_DIR "runlxc.d"
+#define RUNLXC_CONFIG_CACHE "/var/cache/runlxc/runlxc.conf.bin"
 
 #define PROCPS_BUFSIZE 4096
 
@@ -60,16 +63,54 @@ void debug(const char* format, ...)
  *
  */
 volatile sig_atomic_t e_flag = 0;
+volatile sig_atomic_t reload_flag = 0;
+
+// self-pipe: written by the handlers, wakes the main loop
+static int wake_pipe[2] = { -1, -1 };
+
+static void wake_main_loop (void)
+{
+  int saved_errno = errno;
+  char c = 0;
+  if (write(wake_pipe[1], &c, 1) < 0) {
+    // full: a wake up is pending anyway
+  }
+  errno = saved_errno;
+}
 
 static void sigterm_handler (int signum)
 {
   e_flag = 1;
+  wake_main_loop();
+}
+
+static void sighup_handler (int signum)
+{
+  // reload runlxc.conf and runlxc.d in the main loop
+  reload_flag = 1;
+  wake_main_loop();
+}
+
+static void sigchld_handler (int signum)
+{
+  // a container exited, reaped by the main loop
+  wake_main_loop();
+}
+
+static void sigusr1_handler (int signum)
+{
+  // on-demand capture of managed layers
+  ILMControl::request_capture_static();
 }
 
 static void init_signal (void)
 {
   struct sigaction act, info;
 
+  if (pipe2(wake_pipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+    AGL_FATAL("Cannot create pipe for signals");
+  }
+
   /* Setup signal for SIGTERM */
   if (!sigaction(SIGTERM, NULL, &info)) {
     if (info.sa_handler == SIG_IGN) {
@@ -83,11 +124,52 @@ static void init_signal (void)
   if (sigemptyset(&act.sa_mask) != 0) {
     AGL_FATAL("Cannot initialize sigaction");
   }
-  act.sa_flags = 0;
+  act.sa_flags = SA_RESTART;
 
   if (sigaction(SIGTERM, &act, &info) != 0) {
     AGL_FATAL("Cannot register signal handler for SIGTERM");
   }
+
+  /* Setup signal for SIGUSR1 (capture request) */
+  act.sa_handler = &sigusr1_handler;
+  act.sa_flags = SA_RESTART;
+
+  if (sigaction(SIGUSR1, &act, NULL) != 0) {
+    AGL_FATAL("Cannot register signal handler for SIGUSR1");
+  }
+
+  /* Setup signal for SIGHUP (config reload) */
+  act.sa_handler = &sighup_handler;
+  act.sa_flags = SA_RESTART;
+
+  if (sigaction(SIGHUP, &act, NULL) != 0) {
+    AGL_FATAL("Cannot register signal handler for SIGHUP");
+  }
+
+  /* Setup signal for SIGCHLD (container exited) */
+  act.sa_handler = &sigchld_handler;
+  act.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+
+  if (sigaction(SIGCHLD, &act, NULL) != 0) {
+    AGL_FATAL("Cannot register signal handler for SIGCHLD");
+  }
+}
+
+/*
+ * sleep until a handler writes the self-pipe; a signal taken before the
+ * call has already written it, so none is lost
+ */
+static void wait_signal (void)
+{
+  struct pollfd pfd = { wake_pipe[0], POLLIN, 0 };
+  if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+    AGL_WARN("poll() of the signal pipe failed (%d)", errno);
+  }
+
+  char buf[64];
+  while (read(wake_pipe[0], buf, sizeof(buf)) > 0) {
+    // drain
+  }
 }
 
 /*
@@ -97,8 +179,9 @@ static void init_signal (void)
  *   id: ilm layer id
  *
  */
-Output::Output (const std::string& name, t_ilm_uint id) 
-  : m_name(name), m_layer_id(id), m_surface_id(0)
+Output::Output (const ScreenConfig& screen, Priority priority)
+  : m_name(screen.m_display), m_layer_id(screen.m_layer_id), m_priority(priority),
+    m_ivi_id_min(screen.m_ivi_id_min), m_ivi_id_max(screen.m_ivi_id_max)
 {
   AGL_DEBUG("  new output: name=[%s], layer=%d", m_name.c_str(), m_layer_id);
 }
@@ -106,17 +189,28 @@ Output::Output (const std::string& name, t_ilm_uint id)
 /*
  *
  * Container (Guest)
- *   name: container name
+ *   config: [[container]] of runlxc.conf
  *
  */
-Container::Container (const std::string& name) : m_name(name)
+Container::Container (const ContainerConfig& config) : m_config(config)
 {
-  AGL_DEBUG("name = [%s]", m_name.c_str());
+  AGL_DEBUG("name = [%s]", name());
+
+  for (auto& screen : m_config.m_screens) {
+    add_output(screen);
+  }
+
+  for (auto& mirror : m_config.m_mirrors) {
+    if (!add_mirror(mirror)) {
+      AGL_FATAL("Unknown source [%s] of mirror in container:[%s]",
+                mirror.m_source.c_str(), name());
+    }
+  }
 }
 
 void Container::launch (ILMControl *ilmc)
 {
-  AGL_DEBUG("Launch LXC container [name=%s, reboot=%d]", m_name.c_str(), m_reboot);
+  AGL_DEBUG("Launch LXC container [name=%s, reboot=%d]", name(), m_config.m_reboot);
 
   pid_t pid;
 
@@ -125,9 +219,9 @@ void Container::launch (ILMControl *ilmc)
     AGL_FATAL("fork() failed");
   }
 
-   m_lxc = lxc_container_new(m_name.c_str(), NULL);
+   m_lxc = lxc_container_new(name(), NULL);
   if (!m_lxc) {
-    AGL_FATAL("Cannot create container [%s]", m_name.c_str());
+    AGL_FATAL("Cannot create container [%s]", name());
   }
 
   if (!pid) {
@@ -139,19 +233,19 @@ void Container::launch (ILMControl *ilmc)
     // wait for RUNNING
     ret = m_lxc->wait(m_lxc, "RUNNING", 10);
     if (!ret) {
-      AGL_FATAL("container[%s] didn't start.", m_name.c_str());
+      AGL_FATAL("container[%s] didn't start.", name());
       _exit(EXIT_FAILURE);
     }
-    AGL_DEBUG("MONITOR: RUNNING [%s]", m_name.c_str());
+    AGL_DEBUG("MONITOR: RUNNING [%s]", name());
 
     // wait for container STOPPED
     ret = m_lxc->wait(m_lxc, "STOPPED", -1);
     if (!ret) {
-      AGL_FATAL("container[%s] failed to catch STOPPED.", m_name.c_str());
+      AGL_FATAL("container[%s] failed to catch STOPPED.", name());
       _exit(EXIT_FAILURE);
     }
 
-    AGL_DEBUG("MONITOR: STOPPED [%s]", m_name.c_str());
+    AGL_DEBUG("MONITOR: STOPPED [%s]", name());
     _exit(EXIT_SUCCESS);
   }
 
@@ -159,144 +253,275 @@ void Container::launch (ILMControl *ilmc)
 
   // parent process
   //   container's daemonized is enabled
-  m_lxc = lxc_container_new(m_name.c_str(), NULL);
+  m_lxc = lxc_container_new(name(), NULL);
   if (!m_lxc) {
-    AGL_FATAL("Cannot create container [%s]", m_name.c_str());
+    AGL_FATAL("Cannot create container [%s]", name());
   }
 
   if (!m_lxc->is_running(m_lxc)) {
     if (!m_lxc->start(m_lxc, 0, NULL)) {
-      AGL_FATAL("Cannot start container [%s]", m_name.c_str());
+      AGL_FATAL("Cannot start container [%s]", name());
     }
   } else {
-    AGL_DEBUG("Container[%s] is already running.", m_name.c_str());
+    AGL_DEBUG("Container[%s] is already running.", name());
   }
 
   // add extra storages if needed (fake hotplug)
-  for (auto& storage : m_storages) {
+  for (auto& storage : m_config.m_storages) {
     bool ret = m_lxc->add_device_node(m_lxc, storage.m_src.c_str(), storage.m_dst.c_str());
     if (!ret) {
-      AGL_FATAL("Container[%s] fails to add device [%s,%s]", m_name.c_str(),
+      AGL_FATAL("Container[%s] fails to add device [%s,%s]", name(),
                 storage.m_src.c_str(), storage.m_dst.c_str());
     }
-    AGL_DEBUG("Container[%s] add device [%s, %s]", m_name.c_str(), 
+    AGL_DEBUG("Container[%s] add device [%s, %s]", name(), 
               storage.m_src.c_str(), storage.m_dst.c_str());
   }
 
   m_pid = m_lxc->init_pid(m_lxc);
-  AGL_DEBUG("Container[%s] init_pid=%d, wait_pid=%d", m_name.c_str(), m_pid, m_wait_pid);
+  AGL_DEBUG("Container[%s] init_pid=%d, wait_pid=%d", name(), m_pid, m_wait_pid);
 
   AGL_DEBUG("CHECK [%s,%p], pid=%d", this->name(), this, this->m_pid);
 
   for (auto& output : m_outputs) {
-    ilmc->create_layer(output.m_name, output.m_layer_id);
+    ilmc->create_layer(output.m_name, output.m_layer_id, output.m_priority);
+  }
+
+  for (auto& output : m_outputs) {
+    for (auto& mirror : output.m_mirrors) {
+      ilmc->create_layer(mirror.m_display, mirror.m_layer_id, mirror.m_priority);
+    }
   }
 }
 
-void Container::put (void)
+void Container::stop (ILMControl *ilmc)
 {
-  // force clear outputs
+  AGL_DEBUG("Stop LXC container [%s]", name());
+
+  if (m_lxc && m_lxc->is_running(m_lxc)) {
+    if (!m_lxc->stop(m_lxc)) {
+      AGL_WARN("Cannot stop container [%s]", name());
+    }
+  }
+
+  // reap the monitor, it exits on STOPPED
+  if (m_wait_pid > 0) {
+    waitpid(m_wait_pid, NULL, 0);
+    m_wait_pid = -1;
+  }
+
   for (auto& output : m_outputs) {
-    output.m_surface_id = 0;
+    for (auto& mirror : output.m_mirrors) {
+      ilmc->remove_layer(mirror.m_display, mirror.m_layer_id);
+    }
   }
 
+  for (auto& output : m_outputs) {
+    ilmc->remove_layer(output.m_name, output.m_layer_id);
+  }
+
+  put();
+}
+
+void Container::put (void)
+{
+  // outputs bound to surfaces of the old init pid are free again once
+  // the next snapshot is published
+  m_pid = -1;
+
   lxc_container_put(m_lxc);
   m_lxc = NULL;
 }
 
-void Container::add_output (const std::string& name, t_ilm_uint id)
+void Container::add_output (const ScreenConfig& screen)
 {
-  Output output(name, id);
+  Output output(screen, m_config.m_priority);
   m_outputs.push_back(output);
-}
 
-Output* Container::next_output (t_ilm_uint id)
-{
-  for (auto itr = m_outputs.begin(); itr != m_outputs.end(); ++itr) {
-    Output* output = &(*itr);
-    if (output->m_surface_id == id ||
-        output->m_surface_id == 0) {
-      output->m_surface_id = id;
-      return output;
-    }
+  if (screen.m_ivi_id_min != 0) {
+    AGL_DEBUG("  ivi_id: %d-%d", screen.m_ivi_id_min, screen.m_ivi_id_max);
   }
-  return nullptr;
 }
 
-void Container::clear_output (t_ilm_uint id)
+bool Container::add_mirror (const MirrorConfig& mirror)
 {
   for (auto& output : m_outputs) {
-    if (output.m_surface_id == id) {
-      output.m_surface_id = 0;
+    if (output.m_name == mirror.m_source) {
+      AGL_DEBUG("  new mirror: [%s] -> [%s], layer=%d", mirror.m_source.c_str(),
+                mirror.m_display.c_str(), mirror.m_layer_id);
+      output.m_mirrors.push_back(mirror);
+      return true;
     }
   }
-}
-
-void Container::add_storage (const std::string& src, const std::string& dst)
-{
-  Storage storage(src, dst);
-  m_storages.push_back(storage);
+  return false;
 }
 
 /*
  *
- * TOML parser for config
+ * config (runlxc.conf and the fragments in runlxc.d)
  *
  */
-int RunLXC::parse_config (const char *path)
+int RunLXC::load_config (RunLXCConfig& config, uint64_t& hash)
 {
-  auto config = cpptoml::parse_file(path);
+  const char *path = m_config_path.c_str();
 
-  if (config == nullptr) {
-    AGL_DEBUG("cannot parse %s", path);
+  std::vector<ConfigSource> sources;
+  if (read_config_sources(path, m_config_dir.c_str(), sources) < 0) {
+    AGL_DEBUG("cannot read %s nor %s/*.conf", path, m_config_dir.c_str());
     return -1;
   }
 
-  AGL_DEBUG("[%s] parsed", path);
+  // use the compiled snapshot while the sources are unchanged
+  hash = config_hash(sources);
+  if (hash == m_config_hash) {
+    AGL_DEBUG("[%s] unchanged", path);
+    return 0;
+  }
+
+  if (!load_config_cache(RUNLXC_CONFIG_CACHE, hash, config)) {
+    AGL_DEBUG("[%s] loaded from cache (%zu sources)", path, sources.size());
+  } else {
+    std::string error;
+    try {
+      if (parse_config_sources(sources, config, error)) {
+        AGL_WARN("%s", error.c_str());
+        return -1;
+      }
+    } catch (const std::exception& e) {
+      AGL_WARN("[%s] cannot be parsed: %s", path, e.what());
+      return -1;
+    }
+
+    AGL_DEBUG("[%s] parsed (%zu sources)", path, sources.size());
+
+    // safety containers are launched (and their layers committed) first
+    std::stable_partition(config.m_containers.begin(), config.m_containers.end(),
+                          [](const ContainerConfig& c) { return c.m_priority == Priority::SAFETY; });
+
+    save_config_cache(RUNLXC_CONFIG_CACHE, hash, config);
+  }
+
+  return 0;
+}
 
-  auto table_array = config->get_table_array("container");
-  if (table_array == nullptr) {
-    AGL_DEBUG("cannot find array of table, [[container]]");
+int RunLXC::parse_config (void)
+{
+  uint64_t hash;
+  if (load_config(m_config, hash)) {
     return -1;
   }
+  m_config_hash = hash;
 
-  for (const auto& table : *table_array) {
-    // *table is a cpptoml::table
+  for (auto& config : m_config.m_containers) {
+    m_containers.push_back(Container(config));
+  }
 
-    auto name = table->get_as<std::string>("name");
-    if (name->empty()) {
-      AGL_FATAL("No name of container");
-    }
+  return 0;
+}
 
-    Container container(*name);
+/*
+ * reload on SIGHUP
+ *   only the containers whose [[container]] entry was removed, added or
+ *   changed are stopped and/or launched, the others keep running.
+ */
+void RunLXC::reload (void)
+{
+  RunLXCConfig config;
+  uint64_t hash;
 
-    container.m_reboot = *(table->get_as<int>("reboot"));
+  if (load_config(config, hash)) {
+    AGL_WARN("reload failed, keep the current config");
+    return;
+  }
+  if (hash == m_config_hash) {
+    return;
+  }
 
-    auto screen_array = table->get_table_array("screen");
-    for (const auto& screen : *screen_array) {
-      std::string dpy_name = *(screen->get_as<std::string>("display"));
-      if (dpy_name.empty()) {
-        AGL_FATAL("No name of display in container:[%s]", dpy_name.c_str());
-      }
+  std::map<std::string, const ContainerConfig*> next;
+  for (auto& c : config.m_containers) {
+    next[c.m_name] = &c;
+  }
 
-      container.add_output(dpy_name, *(screen->get_as<t_ilm_uint>("layer")));
+  // stop removed or changed containers first, their layer ids may be reused
+  for (auto& container : m_containers) {
+    auto found = next.find(container.config().m_name);
+    if (found == next.end() || *found->second != container.config()) {
+      container.stop(m_ilm_c);
     }
+  }
 
-    auto storage_array = table->get_table_array("storage");
-    if (storage_array) {
-      for (const auto& storage : *storage_array) {
-        std::string src = *(storage->get_as<std::string>("src"));
-        if (src.empty()) {
-          AGL_FATAL("No src of storage in container:[%s]", src.c_str());
-        }
-        container.add_storage(src, *(storage->get_as<std::string>("dst")));
-      }
+  m_containers.erase(std::remove_if(m_containers.begin(), m_containers.end(),
+                                    [&next](const Container& c) {
+                                      auto found = next.find(c.config().m_name);
+                                      return found == next.end() || *found->second != c.config();
+                                    }),
+                     m_containers.end());
+
+  std::vector<size_t> added;
+  for (auto& c : config.m_containers) {
+    auto found = std::find_if(m_containers.begin(), m_containers.end(),
+                              [&c](const Container& container) {
+                                return container.config().m_name == c.m_name;
+                              });
+    if (found == m_containers.end()) {
+      added.push_back(m_containers.size());
+      m_containers.push_back(Container(c));
     }
+  }
 
-    m_containers.push_back(container);
+  if (config.m_ilm.m_coalesce != m_config.m_ilm.m_coalesce) {
+    m_ilm_c->set_coalesce(config.m_ilm.m_coalesce);
+  }
+  if (!(config.m_capture == m_config.m_capture)) {
+    AGL_WARN("[capture] changed, restart runlxc to apply");
   }
 
-  return 0;
+  m_config = config;
+  m_config_hash = hash;
+  publish_snapshot();
+
+  launch(added, 0);
+
+  AGL_DEBUG("reloaded: %zu containers, %zu launched", m_containers.size(), added.size());
+}
+
+/*
+ * launch m_containers[i] of the given indices, safety containers first
+ *   every launch is published and committed before the next one, so the
+ *   layers of a safety container never wait behind those of the others.
+ */
+void RunLXC::launch (std::vector<size_t> indices, unsigned int delay)
+{
+  std::stable_partition(indices.begin(), indices.end(),
+                        [this](size_t i) { return m_containers[i].config().m_priority == Priority::SAFETY; });
+
+  for (auto i : indices) {
+    m_containers[i].launch(m_ilm_c);
+    publish_snapshot();
+    ilm_commitChanges();
+    if (delay) {
+      sleep(delay);
+    }
+  }
+}
+
+/*
+ * publish the config and the init pids of the containers, see
+ * ConfigSnapshots (the ILM notify thread reads only the snapshot)
+ */
+void RunLXC::publish_snapshot (void)
+{
+  ConfigSnapshot *snapshot = new ConfigSnapshot;
+  snapshot->m_hash = m_config_hash;
+  snapshot->m_config.m_ilm = m_config.m_ilm;
+  snapshot->m_config.m_capture = m_config.m_capture;
+  for (auto& container : m_containers) {
+    snapshot->m_config.m_containers.push_back(container.config());
+    snapshot->m_pids.push_back(container.m_pid);
+  }
+  snapshot->build_index();
+
+  m_snapshots.publish(snapshot);
+  AGL_DEBUG("config snapshot %llu published", (unsigned long long)snapshot->m_version);
 }
 
 /*
@@ -310,7 +535,18 @@ void RunLXC::do_loop (volatile sig_atomic_t& e_flag)
   int w_status;
 
   while (!e_flag) {
-    pid_t pid = waitpid(w_pid, &w_status, 0);
+    // checked on every iteration, whatever woke the loop
+    if (reload_flag) {
+      reload_flag = 0;
+      reload();
+      continue;
+    }
+
+    pid_t pid = waitpid(w_pid, &w_status, WNOHANG);
+    if (pid == 0) {
+      wait_signal();
+      continue;
+    }
     if (pid < 0) {
       if (errno == EINTR) {
         AGL_DEBUG("catch EINTR while waitpid()");
@@ -335,7 +571,7 @@ void RunLXC::do_loop (volatile sig_atomic_t& e_flag)
         }
 
         // re-launch container or reboot system
-        if (container.m_reboot) {
+        if (container.config().m_reboot) {
           AGL_DEBUG("rebooting by [%s]...", name);
           sync();
           int ret = reboot(RB_AUTOBOOT);
@@ -348,6 +584,7 @@ void RunLXC::do_loop (volatile sig_atomic_t& e_flag)
           container.put();
 
           container.launch(m_ilm_c);
+          publish_snapshot();
         }
       }
     }
@@ -370,14 +607,28 @@ void RunLXC::do_loop (volatile sig_atomic_t& e_flag)
 RunLXC::RunLXC (void)
 {
   auto path = std::string(RUNLXC_CONFIG_PATH);
-  path = path + "/" + RUNLXC_CONFIG;
+  m_config_dir = path + "/" + RUNLXC_CONFIG_DIR;
+  m_config_path = path + "/" + RUNLXC_CONFIG;
 
   // parse config of runlxc
-  if (parse_config(path.c_str())) {
+  if (parse_config()) {
+#ifdef RUNLXC_DEFAULT_CONFIG
+    // fall back to the config embedded at build time
+    AGL_WARN("Error in parse config, using the built-in default");
+    default_config(m_config);
+    m_config_hash = 0;
+    for (auto& config : m_config.m_containers) {
+      m_containers.push_back(Container(config));
+    }
+#else
     AGL_FATAL("Error in parse config");
+#endif
   }
 
+  publish_snapshot();
+
   m_ilm_c = new ILMControl(this);
+  m_ilm_c->set_coalesce(m_config.m_ilm.m_coalesce);
 
   AGL_DEBUG("RunLXC created.");
 }
@@ -386,60 +637,21 @@ void RunLXC::start (void)
 {
   init_signal();
 
+  if (m_config.m_capture.m_enable) {
+    m_ilm_c->start_capture(m_config.m_capture);
+  }
+
   // start LXC container
-  for (auto& container : m_containers) {
-    container.launch(m_ilm_c);
-    ilm_commitChanges();
-    sleep(1);
+  std::vector<size_t> all(m_containers.size());
+  for (size_t i = 0; i < all.size(); i++) {
+    all[i] = i;
   }
+  launch(all, 1);
 
   ilm_commitChanges();
   do_loop(e_flag);
 }
 
-/*
- * pid: compositor(guest)'s pid
- */
-Container* RunLXC::find_container (pid_t pid)
-{
-  char filename[sizeof("/proc//stat") + sizeof (int) * 3];
-  char buf[PROCPS_BUFSIZE];
-
-  sprintf(filename, "/proc/%d/stat", pid);
-
-  int fd = open(filename, O_RDONLY);
-  if (fd < 0) {
-    return nullptr;
-  }
-
-  int ret = read(fd, buf, PROCPS_BUFSIZE-1);
-  close(fd);
-  buf[ret > 0 ? ret : 0] = '\0';
-
-  char *cp = strrchr(buf, ')');
-
-  if (cp == NULL) {
-    AGL_FATAL("fail to parse PROCPS");
-  }
-
-  char state;
-  pid_t ppid;
-
-  int n = sscanf(cp+2, "%c %u ", &state, &ppid);
-  if (n != 2) {
-    return nullptr;
-  }
-
-  for (auto& container: m_containers) {
-    if (container.m_pid == ppid) {
-      // FOUND
-      return &container;
-    }
-  }
-
-  return nullptr;
-}
-
 int main (int argc, const char* argv[])
 {
   RunLXC runlxc;
@@ -31,20 +31,29 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/wait.h>
+#include <pthread.h>
+#include <stdint.h>
 
 #include <sys/reboot.h>
 #include <lxc/lxccontainer.h>
 
 #include <cstdio>
 
+#include <atomic>
 #include <string>
 #include <vector>
 #include <map>
+#include <set>
+#include <unordered_map>
 #include <algorithm>
 
 #include <ilm/ilm_control.h>
 #include <ilm/ilm_input.h>
 
+#include "config.hpp"
+#include "config_snapshot.hpp"
+#include "signals.hpp"
+
 #define AGL_FATAL(fmt, ...) fatal("ERROR: " fmt "\n", ##__VA_ARGS__)
 #define AGL_WARN(fmt, ...) warn("WARNING: " fmt "\n", ##__VA_ARGS__)
 #define AGL_DEBUG(fmt, ...) debug("DEBUG: " fmt "\n", ##__VA_ARGS__)
@@ -67,28 +76,138 @@ public:
   t_ilm_uint m_id;
   t_ilm_uint m_width;
   t_ilm_uint m_height;
+
+  // layers on this screen in creation order
+  std::vector<std::pair<t_ilm_layer, Priority>> m_layers;
 };
 
 struct Output
 {
 public:
   Output(void) {};
-  Output(const std::string& name, t_ilm_uint id);
+  Output(const ScreenConfig& screen, Priority priority);
 
   std::string m_name;           // name of display
   t_ilm_uint m_layer_id;        // ilm layer id specified by config
+  Priority m_priority = Priority::IVI;
+
+  // expected ivi surface id(s) specified by config, 0: any (creation order)
+  t_ilm_uint m_ivi_id_min = 0;
+  t_ilm_uint m_ivi_id_max = 0;
+
+  // mirrors of this output on other screens (picture-in-picture)
+  //   the guest surface is added to an extra layer whose source rectangle is
+  //   the surface and whose destination rectangle is the configured inset.
+  std::vector<MirrorConfig> m_mirrors;
 
-  t_ilm_uint m_surface_id = 0;  // surface of nested weston (wayland-backend)
+  // owner, while bound to a surface of nested weston (wayland-backend)
+  std::string m_container;
+  pid_t m_pid = -1;             // init pid of the container
+  size_t m_screen = 0;          // index in ContainerConfig::m_screens
 };
 
-struct Storage
+/*
+ * Capture of managed layers/surfaces into a memfd-backed ring.
+ *
+ * The control block (memfd "runlxc-capture") holds a CaptureHeader followed
+ * by slot_count CaptureSlot entries, the first one at sizeof(CaptureHeader). Each slot's image is stored (as an
+ * uncompressed bitmap written by ilmControl) in its own memfd named
+ * "runlxc-capture-N", so a local client can map it from /proc/<pid>/fd
+ * without any copy. A slot memfd never shrinks, so a mapping of it stays
+ * valid while the slot is rewritten. A slot is valid when its seq is
+ * non-zero and unchanged across the read.
+ */
+#define CAPTURE_MAGIC   0x43584c52  /* "RLXC" */
+#define CAPTURE_VERSION 1
+
+struct CaptureSlot
+{
+  uint64_t seq;                 // 0 while being written
+  uint32_t type;                // ILM_LAYER or ILM_SURFACE
+  uint32_t id;                  // layer or surface id
+  uint64_t size;                // bytes valid in the slot memfd
+  uint64_t timestamp;           // CLOCK_MONOTONIC, nsec
+};
+
+struct CaptureHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t slot_count;
+  uint32_t reserved;
+  uint64_t seq;                 // seq of the latest completed slot
+};
+
+class ILMCapture
 {
-  Storage(const std::string& src, const std::string& dst)
-    : m_src(src), m_dst(dst) {};
-  
 public:
-  std::string m_src;
-  std::string m_dst;
+  ILMCapture(const CaptureConfig& config);
+  ~ILMCapture(void);
+
+  void start(void);
+  void request(void);
+
+  void add_layer(t_ilm_uint id);
+  void remove_layer(t_ilm_uint id);
+  void add_surface(t_ilm_uint id);
+  void remove_surface(t_ilm_uint id);
+  bool capture(ilmObjectType type, t_ilm_uint id);
+
+private:
+  CaptureConfig m_config;
+
+  int m_ctl_fd;
+  CaptureHeader *m_header;
+  CaptureSlot *m_slots;         // follow the header in the control block
+  std::vector<int> m_slot_fds;
+  std::vector<uint64_t> m_slot_sizes;   // current size of each slot memfd
+  int m_scratch_fd;             // ilmControl renders here, then copied to a slot
+  uint64_t m_seq;
+
+  int m_event_fd;               // on-demand requests
+  pthread_t m_thread;
+  std::atomic<bool> m_running;
+
+  pthread_mutex_t m_mutex = PTHREAD_MUTEX_INITIALIZER;
+  std::vector<t_ilm_uint> m_layers;
+  std::vector<t_ilm_uint> m_surfaces;   // guest surfaces bound to an output
+
+  static void* thread_main_static (void *arg);
+  void thread_main(void);
+};
+
+/*
+ * Surface notifications waiting for the coalescing window
+ */
+struct PendingSurface
+{
+  uint64_t m_deadline = 0;      // msec, CLOCK_MONOTONIC
+  unsigned int m_events = 0;    // notifications merged into this entry
+  bool m_destroyed = false;     // destroy seen in the window
+  bool m_created = false;       // state after the last notification
+};
+
+/*
+ * Surface notification for the safety thread, in arrival order
+ */
+struct SafetyEvent
+{
+  t_ilm_uint m_id;
+  bool m_created;
+};
+
+struct ConfiguredSurface
+{
+  t_ilm_uint m_id;
+  t_ilm_uint m_width;
+  t_ilm_uint m_height;
+};
+
+struct NotifyStats
+{
+  uint64_t m_received = 0;      // create/destroy notifications
+  uint64_t m_processed = 0;     // create/destroy actually acted on
+  uint64_t m_merged = 0;        // notifications dropped by coalescing
 };
 
 class ILMControl
@@ -103,46 +222,88 @@ public:
 
   static void notify_ilm_cb_static (ilmObjectType object, t_ilm_uint id, t_ilm_bool created, void* user_data);
 
-  void create_layer (const std::string& display, t_ilm_uint id);
+  void create_layer (const std::string& display, t_ilm_uint id, Priority priority);
+  void remove_layer (const std::string& display, t_ilm_uint id);
+
+  void set_coalesce (unsigned int msec);
+  NotifyStats notify_stats (void);
+
+  void start_capture (const CaptureConfig& config);
+  void request_capture (void);
+  static void request_capture_static (void);
 
 private:
   RunLXC *m_runlxc;
   bool m_cb_registered;
+  std::atomic<ILMCapture*> m_capture;   // also used by the notify threads
 
   void configure_ilm_surface (t_ilm_uint id, t_ilm_uint width, t_ilm_uint height);
+  void set_render_order (const std::string& display);
   void notify_surface_cb (t_ilm_uint id, struct ilmSurfaceProperties* prop, t_ilm_notification_mask mask);
   void notify_ilm_cb (ilmObjectType object, t_ilm_uint id, t_ilm_bool created);
 
-  std::map<std::string, ILMScreen> m_screens;
-  std::map<t_ilm_uint, Output> m_created_surfaces;
+  void surface_created (t_ilm_uint surface);
+  bool surface_destroyed (t_ilm_uint surface);
+  bool bind_output (const ConfigSnapshot& snapshot, const ContainerConfig& config, pid_t pid,
+                    t_ilm_uint surface, Output& output);
+  void unbind_output (t_ilm_uint surface, const Output& output);
+  bool is_safety_surface (t_ilm_uint id);
+
+  static void* notify_thread_static (void *arg);
+  void notify_thread (void);
+  static void* safety_thread_static (void *arg);
+  void safety_thread (void);
+
+  // protected by m_output_mutex, which is never held across a commit (the
+  // ILM callback thread may be needed to complete it)
+  pthread_mutex_t m_output_mutex = PTHREAD_MUTEX_INITIALIZER;
+  std::map<std::string, ILMScreen> m_screens;     // layers changed by main, ordered by notify threads
+  std::map<t_ilm_uint, Output> m_created_surfaces;  // bound outputs
+  // (container, init pid) -> surface bound to each of its screens, 0: free
+  std::map<std::pair<std::string, pid_t>, std::vector<t_ilm_uint>> m_bound;
+
+  // protected by m_notify_mutex
+  pthread_mutex_t m_notify_mutex = PTHREAD_MUTEX_INITIALIZER;
+  pthread_cond_t m_notify_cond;
+  pthread_t m_notify_thread;
+  unsigned int m_coalesce;      // coalescing window in msec
+  bool m_notify_running;
+  std::map<t_ilm_uint, PendingSurface> m_pending;
+  std::vector<ConfiguredSurface> m_configured;
+  NotifyStats m_stats;
+
+  // safety surfaces: own thread and queue, never coalesced
+  pthread_cond_t m_safety_cond;
+  pthread_t m_safety_thread;
+  std::vector<SafetyEvent> m_safety_events;
+  std::vector<ConfiguredSurface> m_safety_configured;
+  // ids once bound to a SAFETY output, kept after destroy since a
+  // restarting guest comes back with the same id
+  std::set<t_ilm_uint> m_safety_surfaces;
 };
 
 class Container
 {
 public:
-  Container(const std::string& name);
+  Container(const ContainerConfig& config);
 
   void launch(ILMControl *ilmc);
+  void stop(ILMControl *ilmc);
   void put(void);
 
-  void add_output(const std::string& name, t_ilm_uint id);
-  Output* next_output(t_ilm_uint id);
-  void clear_output(t_ilm_uint id);
-
-  void add_storage(const std::string& src, const std::string& dst);
+  void add_output(const ScreenConfig& screen);
+  bool add_mirror(const MirrorConfig& mirror);
 
-  const char* name(void) { return m_name.c_str(); }
+  const ContainerConfig& config(void) const { return m_config; }
+  const char* name(void) { return m_config.m_name.c_str(); }
 
-  pid_t m_pid;                  // init_pid
-  pid_t m_wait_pid;             // child process for wait(STOPPED)
-
-  bool m_reboot;         // if true, reboot the system when container is stopped
+  pid_t m_pid = -1;             // init_pid
+  pid_t m_wait_pid = -1;        // child process for wait(STOPPED)
 
 private:
-  std::string m_name;           // container name
+  ContainerConfig m_config;
   std::vector<Output> m_outputs;
-  std::vector<Storage> m_storages;
-  struct lxc_container *m_lxc;
+  struct lxc_container *m_lxc = nullptr;
 };
 
 class RunLXC
@@ -151,17 +312,27 @@ public:
   RunLXC(void);
 
   void start(void);
-  Container* find_container (pid_t pid);
 
-  pthread_mutex_t m_mutex = PTHREAD_MUTEX_INITIALIZER;
-  pthread_cond_t m_cond = PTHREAD_COND_INITIALIZER;
+  // config and running containers, for any thread
+  ConfigSnapshots& snapshots(void) { return m_snapshots; }
 
 private:
+  // owned by the main thread, published through m_snapshots
+  RunLXCConfig m_config;
+  uint64_t m_config_hash = 0;
+  std::string m_config_path;
+  std::string m_config_dir;
   std::vector<Container> m_containers;
 
+  ConfigSnapshots m_snapshots;
+
   ILMControl* m_ilm_c;
 
-  int parse_config(const char* file);
+  int load_config(RunLXCConfig& config, uint64_t& hash);
+  int parse_config(void);
+  void reload(void);
+  void launch(std::vector<size_t> indices, unsigned int delay);
+  void publish_snapshot(void);
 
   void do_loop(volatile sig_atomic_t& e_flag);
 };
@@ -0,0 +1,335 @@
+/*
+ * Copyright (c) 2019,2020 Panasonic Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef TOML_SCHEMA_HPP
+#define TOML_SCHEMA_HPP
+
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "cpptoml/cpptoml.h"
+
+/*
+ * Declarative binding of a cpptoml::table into a plain struct
+ *
+ *   static const TomlSchema<Foo> schema = TomlSchema<Foo>()
+ *     .required("name", &Foo::m_name)
+ *     .optional("count", &Foo::m_count)          // default: value in Foo
+ *     .table_array("bar", &Foo::m_bars, bar_schema);
+ *
+ *   schema.bind(*table, foo, "foo");
+ *
+ * bind() walks the entries of the table once, converts each key with type
+ * (and range) checking, then checks that all required keys were seen. A
+ * key the schema does not declare is an error, so that a misspelled key
+ * does not silently fall back to its default. Errors are thrown as
+ * TomlSchemaError carrying the key path and the line of the document, e.g.
+ * "container[1].screen[0].layer: expected integer at line 12".
+ */
+class TomlSchemaError : public std::runtime_error
+{
+public:
+  TomlSchemaError(const std::string& where, const std::string& what, size_t line = 0)
+    : std::runtime_error(where + ": " + what +
+                         (line ? " at line " + std::to_string(line) : std::string())),
+      m_where(where), m_what(what), m_line(line) {};
+
+  size_t line(void) const { return m_line; }
+
+  // the same error at line, unless it already has one
+  TomlSchemaError at_line(size_t line) const
+  {
+    return m_line ? *this : TomlSchemaError(m_where, m_what, line);
+  }
+
+private:
+  std::string m_where;
+  std::string m_what;
+  size_t m_line;
+};
+
+/*
+ * conversion of a TOML value into a field
+ */
+template <class V, class Enable = void>
+struct TomlConverter;
+
+template <>
+struct TomlConverter<std::string>
+{
+  static const char* type_name(void) { return "string"; }
+
+  static bool convert(const std::shared_ptr<cpptoml::base>& b, std::string& out)
+  {
+    auto v = b->as<std::string>();
+    if (!v) {
+      return false;
+    }
+    out = v->get();
+    return true;
+  }
+};
+
+// bool also accepts integer 0/1 (e.g. reboot=1)
+template <>
+struct TomlConverter<bool>
+{
+  static const char* type_name(void) { return "boolean or 0/1"; }
+
+  static bool convert(const std::shared_ptr<cpptoml::base>& b, bool& out)
+  {
+    if (auto v = b->as<bool>()) {
+      out = v->get();
+      return true;
+    }
+    if (auto v = b->as<int64_t>()) {
+      if (v->get() == 0 || v->get() == 1) {
+        out = v->get();
+        return true;
+      }
+    }
+    return false;
+  }
+};
+
+template <class V>
+struct TomlConverter<V, typename std::enable_if<std::is_integral<V>::value &&
+                                                !std::is_same<V, bool>::value>::type>
+{
+  static const char* type_name(void)
+  {
+    return std::is_signed<V>::value ? "integer" : "non-negative integer";
+  }
+
+  static bool convert(const std::shared_ptr<cpptoml::base>& b, V& out)
+  {
+    auto v = b->as<int64_t>();
+    if (!v) {
+      return false;
+    }
+
+    int64_t i = v->get();
+    if (std::is_signed<V>::value) {
+      if (i < (int64_t)(std::numeric_limits<V>::min)() ||
+          i > (int64_t)(std::numeric_limits<V>::max)()) {
+        return false;
+      }
+    } else if (i < 0 || (uint64_t)i > (uint64_t)(std::numeric_limits<V>::max)()) {
+      return false;
+    }
+
+    out = static_cast<V>(i);
+    return true;
+  }
+};
+
+template <class V>
+struct TomlConverter<V, typename std::enable_if<std::is_floating_point<V>::value>::type>
+{
+  static const char* type_name(void) { return "number"; }
+
+  static bool convert(const std::shared_ptr<cpptoml::base>& b, V& out)
+  {
+    // integers are accepted as well
+    auto v = b->as<double>();
+    if (!v) {
+      return false;
+    }
+    out = static_cast<V>(v->get());
+    return true;
+  }
+};
+
+/*
+ * TomlSchema
+ */
+template <class T>
+class TomlSchema
+{
+public:
+  using binder = std::function<void(const std::shared_ptr<cpptoml::base>&, T&, const std::string&)>;
+  using checker = std::function<void(T&, const std::string&)>;
+
+  /*
+   * bind a key by a converter (TomlConverter<V>)
+   */
+  template <class V>
+  TomlSchema& required(const std::string& key, V T::*member)
+  {
+    return field(key, member, true);
+  }
+
+  template <class V>
+  TomlSchema& optional(const std::string& key, V T::*member)
+  {
+    return field(key, member, false);
+  }
+
+  template <class V>
+  TomlSchema& field(const std::string& key, V T::*member, bool required)
+  {
+    return custom(key, [member](const std::shared_ptr<cpptoml::base>& b, T& out,
+                                const std::string& where) {
+      if (!TomlConverter<V>::convert(b, out.*member)) {
+        throw TomlSchemaError(where, std::string("expected ") + TomlConverter<V>::type_name());
+      }
+    }, required);
+  }
+
+  /*
+   * bind a key by a function, e.g. for enums or "int or [min, max]"
+   */
+  TomlSchema& custom(const std::string& key, binder fn, bool required = false)
+  {
+    m_index[key] = m_fields.size();
+    m_fields.push_back({ key, required, fn, std::string() });
+    return *this;
+  }
+
+  /*
+   * bind a sub-table [key] / an array of tables [[key]]
+   */
+  template <class V>
+  TomlSchema& table(const std::string& key, V T::*member, const TomlSchema<V>& schema,
+                    bool required = false)
+  {
+    return custom(key, [member, schema](const std::shared_ptr<cpptoml::base>& b, T& out,
+                                        const std::string& where) {
+      auto t = b->as_table();
+      if (!t) {
+        throw TomlSchemaError(where, "expected table");
+      }
+      schema.bind(*t, out.*member, where);
+    }, required).nested(schema);
+  }
+
+  template <class V>
+  TomlSchema& table_array(const std::string& key, std::vector<V> T::*member,
+                          const TomlSchema<V>& schema, bool required = false)
+  {
+    return custom(key, [member, schema](const std::shared_ptr<cpptoml::base>& b, T& out,
+                                        const std::string& where) {
+      auto ta = b->as_table_array();
+      if (!ta) {
+        throw TomlSchemaError(where, "expected array of tables");
+      }
+
+      auto& vec = out.*member;
+      vec.reserve(vec.size() + ta->get().size());
+      for (auto& t : *ta) {
+        V v;
+        schema.bind(*t, v, where + "[" + std::to_string(vec.size()) + "]");
+        vec.push_back(std::move(v));
+      }
+    }, required).nested(schema);
+  }
+
+  /*
+   * validation after all keys of the table are bound
+   */
+  TomlSchema& check(checker fn)
+  {
+    m_checkers.push_back(fn);
+    return *this;
+  }
+
+  void bind(const cpptoml::table& table, T& out, const std::string& where = "") const
+  {
+    std::vector<bool> seen(m_fields.size(), false);
+
+    // errors of the binders and checkers are located at the line of the
+    // value, or of the table for those about the table as a whole
+    for (auto& entry : table) {
+      std::string key = where.empty() ? entry.first : where + "." + entry.first;
+      auto itr = m_index.find(entry.first);
+      if (itr == m_index.end()) {
+        throw TomlSchemaError(key, "unknown key", entry.second->line());
+      }
+
+      try {
+        m_fields[itr->second].m_bind(entry.second, out, key);
+      } catch (const TomlSchemaError& e) {
+        throw e.at_line(entry.second->line());
+      }
+      seen[itr->second] = true;
+    }
+
+    for (size_t i = 0; i < m_fields.size(); i++) {
+      if (m_fields[i].m_required && !seen[i]) {
+        throw TomlSchemaError(where.empty() ? m_fields[i].m_key : where + "." + m_fields[i].m_key,
+                              "missing required key", table.line());
+      }
+    }
+
+    for (auto& fn : m_checkers) {
+      try {
+        fn(out, where);
+      } catch (const TomlSchemaError& e) {
+        throw e.at_line(table.line());
+      }
+    }
+  }
+
+  /*
+   * keys (required ones marked by '!') including those of sub-tables, e.g.
+   * to tell whether data bound by another build is still valid
+   */
+  std::string signature(void) const
+  {
+    std::string s;
+    for (auto& f : m_fields) {
+      s += f.m_key;
+      if (f.m_required) {
+        s += '!';
+      }
+      if (!f.m_nested.empty()) {
+        s += "{" + f.m_nested + "}";
+      }
+      s += ';';
+    }
+    return s;
+  }
+
+private:
+  struct Field
+  {
+    std::string m_key;
+    bool m_required;
+    binder m_bind;
+    std::string m_nested;       // signature of a sub-table schema
+  };
+
+  template <class V>
+  TomlSchema& nested(const TomlSchema<V>& schema)
+  {
+    m_fields.back().m_nested = schema.signature();
+    return *this;
+  }
+
+  std::vector<Field> m_fields;
+  std::unordered_map<std::string, size_t> m_index;
+  std::vector<checker> m_checkers;
+};
+
+#endif  // TOML_SCHEMA_HPP